@@ -0,0 +1,131 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+// helpers shared by the benches
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+static inline uint64_t bench_now_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// tsc ticks, 0 where there is no tsc
+static inline uint64_t bench_cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static inline long bench_max_rss_kb()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// xorshift64, deterministic so every allocator sees the same sequence
+struct BenchRandom{
+    uint64_t state;
+
+    BenchRandom(uint64_t seed = 88172645463325252ull) : state(seed) {};
+
+    uint64_t next()
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    }
+
+    // uniform in [low, high]
+    size_t range(size_t low, size_t high)
+    {
+        return low + next() % (high - low + 1);
+    }
+};
+
+enum BenchCounter {counter_instructions, counter_branch_misses, counter_llc_misses, counter_dtlb_misses, NUM_BENCH_COUNTERS};
+
+// hardware counters of the calling thread (user space only, so perf_event_paranoid 2 is enough).
+// a counter the kernel or the cpu doesn't give us stays unavailable and the rest still count
+struct BenchCounters{
+    int fds[NUM_BENCH_COUNTERS];
+    bool counted[NUM_BENCH_COUNTERS];
+    uint64_t values[NUM_BENCH_COUNTERS];
+
+    BenchCounters()
+    {
+        for (int i = 0; i < NUM_BENCH_COUNTERS; i++){
+            fds[i] = -1;
+            counted[i] = false;
+            values[i] = 0;
+        }
+    }
+
+    static const char* name(int counter)
+    {
+        static const char* const names[NUM_BENCH_COUNTERS] = {"instr", "br-miss", "llc-miss", "dtlb-miss"};
+        return names[counter];
+    }
+
+    void start()
+    {
+        static const uint32_t types[NUM_BENCH_COUNTERS] = {PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE};
+        static const uint64_t configs[NUM_BENCH_COUNTERS] = {
+            PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_BRANCH_MISSES,
+            PERF_COUNT_HW_CACHE_MISSES, // last level cache
+            PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+        };
+
+        for (int i = 0; i < NUM_BENCH_COUNTERS; i++)
+        {
+            struct perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = types[i];
+            attr.config = configs[i];
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+
+            fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+            if (fds[i] >= 0){
+                ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+                ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+    }
+
+    void stop()
+    {
+        for (int i = 0; i < NUM_BENCH_COUNTERS; i++)
+        {
+            if (fds[i] < 0)
+                continue;
+            ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+            counted[i] = read(fds[i], &values[i], sizeof(values[i])) == sizeof(values[i]);
+            close(fds[i]);
+            fds[i] = -1;
+        }
+    }
+};
+
+#endif /* BENCH_H */
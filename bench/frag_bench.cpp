@@ -0,0 +1,106 @@
+// long running workload with mixed lifetimes and sizes around the mmap threshold, samples the heap into csv
+// usage: frag_bench_<n> [steps] [sample every]
+#include <cstdio>
+#include <cstdlib>
+#include <queue>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include "bench.h"
+#include "my_stdlib.h"
+#include "smalloc_ext.h"
+
+// the buddy allocators have it, the system one leaves the largest free order column empty
+#pragma weak smalloc_largest_free_order
+
+#define DEFAULT_STEPS 1000000
+#define DEFAULT_SAMPLE_EVERY 1000
+
+struct Block{
+    size_t expiry;
+    void* p;
+    size_t size;
+
+    bool operator>(const Block& other) const { return expiry > other.expiry; }
+};
+
+// one allocation per step: mostly small blocks, a few of them cached for a long time, medium buffers that
+// come and go, and rare large ones on both sides of the 128KB mmap threshold
+static void next_block(BenchRandom& random, size_t step, Block& block)
+{
+    size_t kind = random.range(0, 99);
+    size_t lifetime_kind = random.range(0, 99);
+    if (kind < 80){
+        block.size = random.range(16, 512);
+        if (lifetime_kind < 70)
+            block.expiry = step + random.range(1, 16);
+        else if (lifetime_kind < 95)
+            block.expiry = step + random.range(16, 4096);
+        else
+            block.expiry = step + random.range(10000, 100000);
+    } else if (kind < 97){
+        block.size = random.range(512, 32 * 1024);
+        block.expiry = step + (lifetime_kind < 90 ? random.range(1, 64) : random.range(64, 1024));
+    } else {
+        block.size = random.range(64 * 1024, 256 * 1024);
+        block.expiry = step + random.range(1, 256);
+    }
+}
+
+static long resident_kb()
+{
+    long size, resident;
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (statm == NULL)
+        return -1;
+    int read = fscanf(statm, "%ld %ld", &size, &resident);
+    fclose(statm);
+    return read == 2 ? resident * (sysconf(_SC_PAGESIZE) / 1024) : -1;
+}
+
+int main(int argc, char** argv)
+{
+    size_t steps = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_STEPS;
+    size_t sample_every = argc > 2 ? strtoul(argv[2], NULL, 10) : DEFAULT_SAMPLE_EVERY;
+    if (sample_every == 0)
+        sample_every = 1;
+
+    std::priority_queue<Block, std::vector<Block>, std::greater<Block> > live;
+    BenchRandom random;
+    size_t live_bytes = 0, failures = 0;
+    uint64_t start = bench_now_ns();
+
+    printf("allocator,step,seconds,live_blocks,live_bytes,rss_kb,free_bytes,allocated_bytes,largest_free_order,failures\n");
+    for (size_t step = 0; step <= steps; step++)
+    {
+        while (!live.empty() && live.top().expiry <= step)
+        {
+            sfree(live.top().p);
+            live_bytes -= live.top().size;
+            live.pop();
+        }
+
+        Block block;
+        next_block(random, step, block);
+        block.p = smalloc(block.size);
+        if (block.p == NULL){
+            ++failures;
+        } else {
+            ((volatile char*)block.p)[0] = 1;
+            ((volatile char*)block.p)[block.size - 1] = 1;
+            live_bytes += block.size;
+            live.push(block);
+        }
+
+        if (step % sample_every == 0){
+            printf("%s,%zu,%.3f,%zu,%zu,%ld,%zu,%zu,", BENCH_ALLOCATOR, step, (bench_now_ns() - start) / 1e9,
+                live.size(), live_bytes, resident_kb(), _num_free_bytes(), _num_allocated_bytes());
+            if (smalloc_largest_free_order != NULL)
+                printf("%d", smalloc_largest_free_order());
+            printf(",%zu\n", failures);
+            fflush(stdout);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,59 @@
+// the smalloc api over the system allocator, so the benches can compare against glibc
+#include <cstdlib>
+#include <malloc.h>
+
+#include "my_stdlib.h"
+
+void* smalloc(size_t size)
+{
+    return malloc(size);
+}
+
+void* scalloc(size_t num, size_t size)
+{
+    return calloc(num, size);
+}
+
+void sfree(void* p)
+{
+    free(p);
+}
+
+void* srealloc(void* oldp, size_t size)
+{
+    return realloc(oldp, size);
+}
+
+// glibc doesn't count its in use chunks, so the block counts only cover free and mmapped chunks,
+// and the byte counts include the bench's own allocations
+size_t _num_free_blocks()
+{
+    return mallinfo2().ordblks;
+}
+
+size_t _num_free_bytes()
+{
+    return mallinfo2().fordblks;
+}
+
+size_t _num_allocated_blocks()
+{
+    struct mallinfo2 info = mallinfo2();
+    return info.ordblks + info.hblks;
+}
+
+size_t _num_allocated_bytes()
+{
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.fordblks + info.hblkhd;
+}
+
+size_t _num_meta_data_bytes()
+{
+    return 0;
+}
+
+size_t _size_meta_data()
+{
+    return 0;
+}
@@ -0,0 +1,99 @@
+// renders a smalloc_dump_heap map as ascii, one line per superblock
+// usage: heapviz [map file], reads stdin without one
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "smalloc_ext.h"
+
+#define COLUMNS 128
+#define PINNED_FRACTION 16 // a superblock that is at most 1/16 used but can't be handed out whole is pinned
+
+int main(int argc, char** argv)
+{
+    FILE* file = argc > 1 ? fopen(argv[1], "rb") : stdin;
+    if (file == NULL){
+        perror(argv[1]);
+        return 1;
+    }
+
+    SmallocHeapHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || std::memcmp(header.magic, SMALLOC_HEAP_MAGIC, sizeof(header.magic)) != 0){
+        fprintf(stderr, "not a heap map\n");
+        return 1;
+    }
+
+    size_t units = header.superblock_size / header.min_block_size;
+    size_t units_per_column = units > COLUMNS ? units / COLUMNS : 1;
+    size_t columns = units / units_per_column;
+    std::vector<size_t> free_blocks(SMALLOC_STATS_ORDERS), used_blocks(SMALLOC_STATS_ORDERS);
+    size_t pinned = 0;
+
+    printf("heap at %#llx: %u superblocks of %u KB, a column is %zu bytes ('#' used, '+' partly used, '.' free)\n",
+        (unsigned long long)header.heap_base, header.superblocks, header.superblock_size / 1024, units_per_column * header.min_block_size);
+
+    for (uint32_t i = 0; i < header.superblocks; i++)
+    {
+        uint32_t num_blocks;
+        std::vector<uint8_t> blocks;
+        if (fread(&num_blocks, sizeof(num_blocks), 1, file) != 1 || num_blocks > units){
+            fprintf(stderr, "truncated heap map\n");
+            return 1;
+        }
+        blocks.resize(num_blocks);
+        if (fread(blocks.data(), 1, num_blocks, file) != num_blocks){
+            fprintf(stderr, "truncated heap map\n");
+            return 1;
+        }
+
+        // mark the min size units every used block covers
+        std::vector<bool> used(units);
+        size_t unit = 0, used_bytes = 0, largest_free = 0;
+        for (uint8_t block : blocks)
+        {
+            size_t order = block & ~SMALLOC_HEAP_USED;
+            size_t block_units = (size_t)1 << order;
+            if (order >= SMALLOC_STATS_ORDERS || unit + block_units > units){
+                fprintf(stderr, "corrupt heap map\n");
+                return 1;
+            }
+
+            if (block & SMALLOC_HEAP_USED){
+                ++used_blocks[order];
+                used_bytes += block_units * header.min_block_size;
+                for (size_t j = unit; j < unit + block_units; j++)
+                    used[j] = true;
+            } else {
+                ++free_blocks[order];
+                if (block_units * header.min_block_size > largest_free)
+                    largest_free = block_units * header.min_block_size;
+            }
+            unit += block_units;
+        }
+
+        char line[COLUMNS + 1];
+        for (size_t column = 0; column < columns; column++)
+        {
+            size_t used_units = 0;
+            for (size_t j = column * units_per_column; j < (column + 1) * units_per_column; j++)
+                used_units += used[j];
+            line[column] = used_units == 0 ? '.' : used_units == units_per_column ? '#' : '+';
+        }
+        line[columns] = '\0';
+
+        bool is_pinned = used_bytes > 0 && used_bytes <= header.superblock_size / PINNED_FRACTION;
+        pinned += is_pinned;
+        printf("%2u |%s| %4zu blocks, %7zu used, largest free %6zu%s\n", i, line, blocks.size(), used_bytes, largest_free,
+            is_pinned ? "  pinned" : "");
+    }
+
+    printf("\norder  block size  free  used\n");
+    for (size_t order = 0; order < SMALLOC_STATS_ORDERS; order++)
+        printf("%5zu  %10zu  %4zu  %4zu\n", order, (size_t)header.min_block_size << order, free_blocks[order], used_blocks[order]);
+    printf("%zu pinned superblocks (at most 1/%d used)\n", pinned, PINNED_FRACTION);
+
+    if (file != stdin)
+        fclose(file);
+    return 0;
+}
@@ -0,0 +1,29 @@
+// the rest of the smalloc api over malloc_1.cpp, which only has smalloc. blocks are never reused
+#include <cstring>
+#include <unistd.h>
+
+#include "my_stdlib.h"
+
+void* scalloc(size_t num, size_t size)
+{
+    void* p = smalloc(num * size);
+    if (p != NULL)
+        std::memset(p, 0, num * size);
+    return p;
+}
+
+void sfree(void*)
+{
+}
+
+// the old size isn't kept anywhere, so copy as much as could belong to it: up to the new block, which comes after it
+void* srealloc(void* oldp, size_t size)
+{
+    void* newp = smalloc(size);
+    if (newp == NULL || oldp == NULL)
+        return newp;
+
+    size_t available = (char*)newp - (char*)oldp;
+    std::memmove(newp, oldp, available < size ? available : size);
+    return newp;
+}
@@ -0,0 +1,247 @@
+// standard workloads against the allocator the binary is linked with, each in a fresh process
+// usage: malloc_bench_<n> [ops] [workload]
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include "bench.h"
+#include "my_stdlib.h"
+
+#define DEFAULT_OPS 1000000
+#define SLOTS 512 // live blocks, keeps the live set under ~2MB so it fits the buddy heap
+#define LARGE_BLOCK_SIZE (8 << 20)
+#define LARGE_OPS_PER_BLOCK 1000 // the large workload allocates one block per this many ops
+#define LARGE_TOUCHES 65536
+
+struct Result{
+    size_t ops;
+    size_t failures;
+};
+
+static void touch(void* p, size_t size)
+{
+    ((volatile char*)p)[0] = 1;
+    ((volatile char*)p)[size - 1] = 1;
+}
+
+static void allocate(void** slot, size_t size, Result& result)
+{
+    *slot = smalloc(size);
+    ++result.ops;
+    if (*slot == NULL)
+        ++result.failures;
+    else
+        touch(*slot, size);
+}
+
+static void release(void** slot, Result& result)
+{
+    if (*slot == NULL)
+        return;
+    sfree(*slot);
+    *slot = NULL;
+    ++result.ops;
+}
+
+static void release_all(std::vector<void*>& slots, Result& result)
+{
+    for (size_t i = 0; i < slots.size(); i++)
+        release(&slots[i], result);
+}
+
+// one size, the free list always has an exact fit
+static Result churn(size_t ops)
+{
+    Result result = {0, 0};
+    std::vector<void*> slots(SLOTS);
+    for (size_t i = 0; result.ops < ops; i++)
+    {
+        release(&slots[i % SLOTS], result);
+        allocate(&slots[i % SLOTS], 64, result);
+    }
+    release_all(slots, result);
+    return result;
+}
+
+static Result random_sizes(size_t ops)
+{
+    Result result = {0, 0};
+    BenchRandom random;
+    std::vector<void*> slots(SLOTS);
+    while (result.ops < ops)
+    {
+        void** slot = &slots[random.next() % SLOTS];
+        release(slot, result);
+        allocate(slot, random.range(1, 4096), result);
+    }
+    release_all(slots, result);
+    return result;
+}
+
+// 2^k - 1, 2^k and 2^k + 1: the sizes where a power of two block allocator wastes the most or least
+static Result pow2_boundaries(size_t ops)
+{
+    Result result = {0, 0};
+    BenchRandom random;
+    std::vector<void*> slots(SLOTS);
+    while (result.ops < ops)
+    {
+        void** slot = &slots[random.next() % SLOTS];
+        release(slot, result);
+        allocate(slot, ((size_t)1 << random.range(4, 12)) + random.range(0, 2) - 1, result);
+    }
+    release_all(slots, result);
+    return result;
+}
+
+// allocates a batch, then frees it newest first (lifo) or oldest first
+static Result batch(size_t ops, bool lifo)
+{
+    Result result = {0, 0};
+    BenchRandom random;
+    std::vector<void*> slots(SLOTS * 2);
+    while (result.ops < ops)
+    {
+        for (size_t i = 0; i < slots.size(); i++)
+            allocate(&slots[i], random.range(16, 512), result);
+        for (size_t i = 0; i < slots.size(); i++)
+            release(&slots[lifo ? slots.size() - 1 - i : i], result);
+    }
+    return result;
+}
+
+static Result lifo(size_t ops)
+{
+    return batch(ops, true);
+}
+
+static Result fifo(size_t ops)
+{
+    return batch(ops, false);
+}
+
+// a vector growing by half its size up to 64KB
+static Result realloc_growth(size_t ops)
+{
+    Result result = {0, 0};
+    while (result.ops < ops)
+    {
+        void* p = NULL;
+        allocate(&p, 16, result);
+        for (size_t size = 24; p != NULL && size <= 64 * 1024; size += size / 2)
+        {
+            void* newp = srealloc(p, size);
+            ++result.ops;
+            if (newp == NULL){
+                ++result.failures;
+                break;
+            }
+            p = newp;
+            touch(p, size);
+        }
+        release(&p, result);
+    }
+    return result;
+}
+
+// few 8MB blocks (MAP_HUGETLB in malloc_4) read at random pages, so the time and counters per op are mostly
+// the tlb misses of touching them
+static Result large(size_t ops)
+{
+    Result result = {0, 0};
+    BenchRandom random;
+    for (size_t i = 0; i < (ops + LARGE_OPS_PER_BLOCK - 1) / LARGE_OPS_PER_BLOCK; i++)
+    {
+        void* p = NULL;
+        allocate(&p, LARGE_BLOCK_SIZE, result);
+        if (p == NULL)
+            continue;
+        for (size_t j = 0; j < LARGE_TOUCHES; j++)
+            ((volatile char*)p)[random.next() % LARGE_BLOCK_SIZE] += 1;
+        release(&p, result);
+    }
+    return result;
+}
+
+struct Workload{
+    const char* name;
+    Result (*run)(size_t ops);
+    bool needs_free; // n/a for malloc_1, which would keep every block
+};
+
+static const Workload workloads[] = {
+    {"churn", churn, false},
+    {"random", random_sizes, false},
+    {"pow2", pow2_boundaries, false},
+    {"lifo", lifo, false},
+    {"fifo", fifo, false},
+    {"realloc", realloc_growth, true},
+    {"large", large, true},
+};
+
+// runs in a child so every workload starts from an empty heap and gets its own peak rss
+static void run(const Workload& workload, size_t ops)
+{
+#ifdef BENCH_NO_FREE
+    if (workload.needs_free){
+        printf("%-14s %-8s %10s\n", BENCH_ALLOCATOR, workload.name, "n/a");
+        return;
+    }
+#endif
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0){
+        BenchCounters counters;
+        long rss_before = bench_max_rss_kb();
+        counters.start();
+        uint64_t start = bench_now_ns();
+        uint64_t start_cycles = bench_cycles();
+        Result result = workload.run(ops);
+        uint64_t cycles = bench_cycles() - start_cycles;
+        double seconds = (bench_now_ns() - start) / 1e9;
+        counters.stop();
+
+        printf("%-14s %-8s %10zu %12.0f %10.1f %10ld %10ld %8zu", BENCH_ALLOCATOR, workload.name, result.ops,
+            result.ops / seconds, (double)cycles / result.ops, bench_max_rss_kb(), rss_before, result.failures);
+        for (int i = 0; i < NUM_BENCH_COUNTERS; i++)
+        {
+            if (counters.counted[i])
+                printf(" %12.2f", (double)counters.values[i] / result.ops);
+            else
+                printf(" %12s", "n/a");
+        }
+        printf("\n");
+        fflush(stdout);
+        _exit(0);
+    }
+
+    int status;
+    if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        printf("%-14s %-8s %10s\n", BENCH_ALLOCATOR, workload.name, "crashed");
+}
+
+int main(int argc, char** argv)
+{
+    size_t ops = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_OPS;
+    const char* only = argc > 2 ? argv[2] : NULL;
+#ifdef BENCH_NO_FREE
+    ops /= 10; // nothing is ever reused, keep the heap from growing past a few hundred MB
+#endif
+
+    printf("%-14s %-8s %10s %12s %10s %10s %10s %8s", "allocator", "workload", "ops", "ops/s", "cycles/op", "rss kB", "base kB", "failed");
+    for (int i = 0; i < NUM_BENCH_COUNTERS; i++)
+    {
+        char column[32];
+        snprintf(column, sizeof(column), "%s/op", BenchCounters::name(i));
+        printf(" %12s", column);
+    }
+    printf("\n");
+    for (size_t i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++)
+        if (only == NULL || strcmp(only, workloads[i].name) == 0)
+            run(workloads[i], ops);
+    return 0;
+}
@@ -0,0 +1,262 @@
+// throughput of the allocator it is linked with from 1 to N threads
+// usage: mt_bench_<n> [max threads] [ops per thread] [workload]
+//
+// malloc_2/3/4 are not thread safe, so unless BENCH_THREAD_SAFE is defined every call goes through one harness
+// lock, and the contention column is how often a thread found it taken
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "bench.h"
+#include "my_stdlib.h"
+
+#define DEFAULT_OPS 200000
+#define THREAD_SLOTS 64 // live blocks per thread, 32 threads stay under ~1MB
+#define QUEUE_SIZE 256
+#define LARSON_ROUNDS 4
+
+struct HarnessLock{
+    std::mutex mutex;
+    std::atomic<size_t> acquisitions;
+    std::atomic<size_t> contended;
+
+    HarnessLock() : acquisitions(0), contended(0) {};
+
+    void lock()
+    {
+#ifndef BENCH_THREAD_SAFE
+        acquisitions.fetch_add(1, std::memory_order_relaxed);
+        if (mutex.try_lock())
+            return;
+        contended.fetch_add(1, std::memory_order_relaxed);
+        mutex.lock();
+#endif
+    }
+
+    void unlock()
+    {
+#ifndef BENCH_THREAD_SAFE
+        mutex.unlock();
+#endif
+    }
+};
+
+HarnessLock harness_lock;
+
+static void* bench_malloc(size_t size)
+{
+    harness_lock.lock();
+    void* p = smalloc(size);
+    harness_lock.unlock();
+    if (p != NULL)
+        *(volatile char*)p = 1;
+    return p;
+}
+
+static void bench_free(void* p)
+{
+    if (p == NULL)
+        return;
+    harness_lock.lock();
+    sfree(p);
+    harness_lock.unlock();
+}
+
+struct ThreadResult{
+    size_t ops;
+    uint64_t start_ns;
+    uint64_t end_ns;
+};
+
+// every thread allocates and frees its own blocks
+static void local_churn(size_t id, size_t ops, ThreadResult& result)
+{
+    BenchRandom random(id + 1);
+    void* slots[THREAD_SLOTS] = {NULL};
+    while (result.ops < ops)
+    {
+        void** slot = &slots[random.next() % THREAD_SLOTS];
+        if (*slot != NULL){
+            bench_free(*slot);
+            ++result.ops;
+        }
+        *slot = bench_malloc(random.range(16, 512));
+        ++result.ops;
+    }
+    for (size_t i = 0; i < THREAD_SLOTS; i++)
+        bench_free(slots[i]);
+}
+
+// single producer single consumer ring, the consumer frees what the producer allocated
+struct Queue{
+    void* items[QUEUE_SIZE];
+    std::atomic<size_t> head;
+    std::atomic<size_t> tail;
+
+    Queue() : head(0), tail(0) {};
+
+    void push(void* p)
+    {
+        size_t position = tail.load(std::memory_order_relaxed);
+        while (position - head.load(std::memory_order_acquire) == QUEUE_SIZE)
+            std::this_thread::yield();
+        items[position % QUEUE_SIZE] = p;
+        tail.store(position + 1, std::memory_order_release);
+    }
+
+    void* pop()
+    {
+        size_t position = head.load(std::memory_order_relaxed);
+        while (tail.load(std::memory_order_acquire) == position)
+            std::this_thread::yield();
+        void* p = items[position % QUEUE_SIZE];
+        head.store(position + 1, std::memory_order_release);
+        return p;
+    }
+};
+
+std::vector<Queue> queues;
+
+// even threads produce into their pair's queue, odd ones consume from it
+static void producer_consumer(size_t id, size_t ops, ThreadResult& result)
+{
+    Queue& queue = queues[id / 2];
+    BenchRandom random(id + 1);
+    for (; result.ops < ops; ++result.ops)
+    {
+        if (id % 2 == 0)
+            queue.push(bench_malloc(random.range(16, 512)));
+        else
+            bench_free(queue.pop());
+    }
+}
+
+// larson: server threads replace random blocks, then hand their blocks to the next round's threads,
+// so most frees happen on another thread than the one that allocated
+std::vector<std::vector<void*> > larson_slots;
+size_t larson_round;
+
+static void larson(size_t id, size_t ops, ThreadResult& result)
+{
+    std::vector<void*>& slots = larson_slots[(id + larson_round) % larson_slots.size()];
+    BenchRandom random(id * LARSON_ROUNDS + larson_round + 1);
+    size_t round_ops = ops / LARSON_ROUNDS;
+    while (result.ops < round_ops)
+    {
+        void** slot = &slots[random.next() % slots.size()];
+        if (*slot != NULL){
+            bench_free(*slot);
+            ++result.ops;
+        }
+        *slot = bench_malloc(random.range(16, 512));
+        ++result.ops;
+    }
+}
+
+struct Workload{
+    const char* name;
+    void (*run)(size_t id, size_t ops, ThreadResult& result);
+    size_t min_threads;
+    size_t rounds;
+};
+
+static const Workload workloads[] = {
+    {"local", local_churn, 1, 1},
+    {"prodcons", producer_consumer, 2, 1},
+    {"larson", larson, 1, LARSON_ROUNDS},
+};
+
+static void run(const Workload& workload, size_t threads, size_t ops, double& base_throughput)
+{
+    std::vector<size_t> thread_ops(threads, 0);
+    std::vector<uint64_t> thread_ns(threads, 0);
+    uint64_t wall_ns = 0;
+
+    queues = std::vector<Queue>(threads / 2);
+    larson_slots.assign(threads, std::vector<void*>(THREAD_SLOTS, (void*)NULL));
+    harness_lock.acquisitions = 0;
+    harness_lock.contended = 0;
+
+    for (larson_round = 0; larson_round < workload.rounds; larson_round++)
+    {
+        std::vector<ThreadResult> results(threads);
+        std::vector<std::thread> pool;
+        std::atomic<size_t> ready(0);
+        for (size_t i = 0; i < threads; i++)
+        {
+            pool.push_back(std::thread([&, i]() {
+                ThreadResult& result = results[i];
+                result.ops = 0;
+                ready.fetch_add(1);
+                while (ready.load() < threads) // start together
+                    std::this_thread::yield();
+                result.start_ns = bench_now_ns();
+                workload.run(i, ops, result);
+                result.end_ns = bench_now_ns();
+            }));
+        }
+        for (size_t i = 0; i < threads; i++)
+            pool[i].join();
+
+        uint64_t start = results[0].start_ns, end = results[0].end_ns;
+        for (size_t i = 0; i < threads; i++)
+        {
+            thread_ops[i] += results[i].ops;
+            thread_ns[i] += results[i].end_ns - results[i].start_ns;
+            start = std::min(start, results[i].start_ns);
+            end = std::max(end, results[i].end_ns);
+        }
+        wall_ns += end - start;
+    }
+    for (size_t i = 0; i < larson_slots.size(); i++)
+        for (size_t j = 0; j < larson_slots[i].size(); j++)
+            bench_free(larson_slots[i][j]);
+
+    size_t total_ops = 0;
+    double min_thread = 0, max_thread = 0;
+    for (size_t i = 0; i < threads; i++)
+    {
+        double thread_throughput = thread_ops[i] / (thread_ns[i] / 1e9);
+        min_thread = i == 0 ? thread_throughput : std::min(min_thread, thread_throughput);
+        max_thread = std::max(max_thread, thread_throughput);
+        total_ops += thread_ops[i];
+    }
+
+    double throughput = total_ops / (wall_ns / 1e9);
+    if (base_throughput == 0)
+        base_throughput = throughput;
+
+    char contention[16] = "-";
+#ifndef BENCH_THREAD_SAFE
+    snprintf(contention, sizeof(contention), "%.1f%%",
+        harness_lock.acquisitions == 0 ? 0.0 : 100.0 * harness_lock.contended / harness_lock.acquisitions);
+#endif
+    printf("%-10s %-9s %7zu %12.0f %12.0f %12.0f %12.0f %8.2f %10s\n", BENCH_ALLOCATOR, workload.name, threads,
+        throughput, throughput / threads, min_thread, max_thread, throughput / base_throughput, contention);
+    fflush(stdout);
+}
+
+int main(int argc, char** argv)
+{
+    size_t max_threads = argc > 1 ? strtoul(argv[1], NULL, 10) : std::min(8u, std::max(1u, std::thread::hardware_concurrency()));
+    size_t ops = argc > 2 ? strtoul(argv[2], NULL, 10) : DEFAULT_OPS;
+    const char* only = argc > 3 ? argv[3] : NULL;
+
+    printf("%-10s %-9s %7s %12s %12s %12s %12s %8s %10s\n", "allocator", "workload", "threads", "ops/s", "ops/s/thread",
+        "min thread", "max thread", "scaling", "contended");
+    for (size_t i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++)
+    {
+        if (only != NULL && strcmp(only, workloads[i].name) != 0)
+            continue;
+
+        double base_throughput = 0;
+        for (size_t threads = workloads[i].min_threads; threads <= max_threads; threads *= 2)
+            run(workloads[i], threads, ops, base_throughput);
+    }
+    return 0;
+}
@@ -0,0 +1,221 @@
+// replays a trace recorded with SMALLOC_TRACE_FILE against the allocator it is linked with
+// usage: sreplay <trace file>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+#include "bench.h"
+#include "my_stdlib.h"
+#include "smalloc_ext.h"
+
+// only malloc_4 has them all (malloc_3 has sexpand), replay_* stand in for the others
+#pragma weak smallocx
+#pragma weak sreallocx
+#pragma weak sexpand
+
+struct Heap{
+    size_t live_bytes;
+    size_t allocated_bytes;
+    size_t free_bytes;
+    size_t meta_data_bytes;
+};
+
+static bool read_trace(const char* path, std::vector<SmallocTraceRecord>& records)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == NULL){
+        perror(path);
+        return false;
+    }
+
+    SmallocTraceHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        std::memcmp(header.magic, SMALLOC_TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.record_size != sizeof(SmallocTraceRecord)){
+        fprintf(stderr, "%s: not a trace file\n", path);
+        fclose(file);
+        return false;
+    }
+
+    SmallocTraceRecord record;
+    while (fread(&record, sizeof(record), 1, file) == 1)
+        records.push_back(record);
+    fclose(file);
+
+    // every thread flushes its own buffer, so the file is only ordered per thread
+    std::stable_sort(records.begin(), records.end(),
+        [](const SmallocTraceRecord& a, const SmallocTraceRecord& b) { return a.timestamp < b.timestamp; });
+    return true;
+}
+
+// srealloc, sreallocx and sexpand: the block at old_ptr is gone unless the call failed
+static bool is_realloc(uint8_t op)
+{
+    return op == SMALLOC_TRACE_SREALLOC || op == SMALLOC_TRACE_SREALLOCX || op == SMALLOC_TRACE_SEXPAND;
+}
+
+static void* replay_sexpand(void* p, size_t size)
+{
+    return sexpand != NULL ? sexpand(p, size) : NULL; // can't grow in place
+}
+
+static void* replay_smallocx(size_t size, int flags)
+{
+    if (smallocx != NULL)
+        return smallocx(size, flags);
+    return (flags & SMALLOCX_ZERO) ? scalloc(1, size) : smalloc(size); // without the alignment
+}
+
+static void* replay_sreallocx(void* p, size_t size, int flags)
+{
+    if (sreallocx != NULL)
+        return sreallocx(p, size, flags);
+    return (flags & SMALLOCX_NO_MOVE) ? replay_sexpand(p, size) : srealloc(p, size);
+}
+
+// index of the record after which the most requested bytes are live, found from the trace alone
+// so that the replay only has to stop once to look at the heap
+static size_t find_peak(const std::vector<SmallocTraceRecord>& records)
+{
+    std::unordered_map<uint64_t, uint32_t> sizes;
+    sizes.reserve(records.size());
+    size_t live = 0, peak = 0, peak_index = 0;
+
+    for (size_t i = 0; i < records.size(); i++){
+        const SmallocTraceRecord& record = records[i];
+        if (record.op == SMALLOC_TRACE_SFREE || (is_realloc(record.op) && record.ptr != 0)){
+            uint64_t old_ptr = record.op == SMALLOC_TRACE_SFREE ? record.ptr : record.old_ptr;
+            std::unordered_map<uint64_t, uint32_t>::iterator it = sizes.find(old_ptr);
+            if (it != sizes.end()){
+                live -= it->second;
+                sizes.erase(it);
+            }
+        }
+        if (record.op != SMALLOC_TRACE_SFREE && record.ptr != 0){
+            sizes[record.ptr] = record.size;
+            live += record.size;
+        }
+        if (live > peak){
+            peak = live;
+            peak_index = i;
+        }
+    }
+    return peak_index;
+}
+
+static Heap snapshot(size_t live_bytes)
+{
+    Heap heap;
+    heap.live_bytes = live_bytes;
+    heap.allocated_bytes = _num_allocated_bytes();
+    heap.free_bytes = _num_free_bytes();
+    heap.meta_data_bytes = _num_meta_data_bytes();
+    return heap;
+}
+
+static void print_heap(const char* name, const Heap& heap)
+{
+    size_t footprint = heap.allocated_bytes + heap.meta_data_bytes;
+    printf("%s: live %zu bytes, heap %zu bytes (%zu free, %zu metadata), overhead %.2fx\n", name,
+        heap.live_bytes, footprint, heap.free_bytes, heap.meta_data_bytes,
+        heap.live_bytes == 0 ? 0.0 : (double)footprint / heap.live_bytes);
+}
+
+int main(int argc, char** argv)
+{
+    if (argc != 2){
+        fprintf(stderr, "usage: %s <trace file>\n", argv[0]);
+        return 2;
+    }
+
+    std::vector<SmallocTraceRecord> records;
+    if (!read_trace(argv[1], records))
+        return 1;
+    size_t peak_index = find_peak(records);
+
+    // recorded pointer -> replayed pointer and its requested size, sized up front to keep rehashing out of the replay
+    std::unordered_map<uint64_t, std::pair<void*, uint32_t> > blocks;
+    blocks.reserve(records.size());
+
+    size_t live = 0, failures = 0;
+    Heap peak = {0, 0, 0, 0};
+    long rss_before = bench_max_rss_kb();
+
+    uint64_t start = bench_now_ns();
+
+    for (size_t i = 0; i < records.size(); i++){
+        const SmallocTraceRecord& record = records[i];
+        void* old_p = NULL;
+        uint32_t old_size = 0;
+
+        if (record.op == SMALLOC_TRACE_SFREE || is_realloc(record.op)){
+            uint64_t old_ptr = record.op == SMALLOC_TRACE_SFREE ? record.ptr : record.old_ptr;
+            std::unordered_map<uint64_t, std::pair<void*, uint32_t> >::iterator it = blocks.find(old_ptr);
+            if (it != blocks.end()){
+                old_p = it->second.first;
+                old_size = it->second.second;
+                blocks.erase(it);
+            }
+        }
+
+        void* p = NULL;
+        switch (record.op){
+            case SMALLOC_TRACE_SMALLOC:
+                p = smalloc(record.size);
+                break;
+            case SMALLOC_TRACE_SCALLOC:
+                p = scalloc(1, record.size);
+                break;
+            case SMALLOC_TRACE_SMALLOCX:
+                p = replay_smallocx(record.size, record.flags);
+                break;
+            case SMALLOC_TRACE_SREALLOC:
+            case SMALLOC_TRACE_SREALLOCX:
+            case SMALLOC_TRACE_SEXPAND:
+                if (record.op == SMALLOC_TRACE_SREALLOC)
+                    p = srealloc(old_p, record.size);
+                else if (record.op == SMALLOC_TRACE_SREALLOCX)
+                    p = replay_sreallocx(old_p, record.size, record.flags);
+                else
+                    p = old_p != NULL ? replay_sexpand(old_p, record.size) : NULL;
+
+                if (p == NULL && old_p != NULL) // the old block is still there
+                    blocks[record.old_ptr] = std::make_pair(old_p, old_size);
+                else
+                    live -= old_size;
+                break;
+            case SMALLOC_TRACE_SFREE:
+                sfree(old_p);
+                live -= old_size;
+                break;
+        }
+
+        if (record.op != SMALLOC_TRACE_SFREE && p != NULL){
+            if (record.ptr != 0){
+                blocks[record.ptr] = std::make_pair(p, record.size);
+                live += record.size;
+            } else if (record.old_ptr != 0){ // failed when recorded, the caller kept the old pointer
+                blocks[record.old_ptr] = std::make_pair(p, old_size);
+                live += old_size;
+            }
+        } else if (record.op != SMALLOC_TRACE_SFREE && record.ptr != 0){
+            failures++;
+        }
+
+        if (i == peak_index)
+            peak = snapshot(live);
+    }
+
+    double seconds = (bench_now_ns() - start) / 1e9;
+    long rss_after = bench_max_rss_kb();
+
+    printf("%zu ops in %.3f s, %.0f ops/s, %zu failed\n", records.size(), seconds,
+        seconds > 0 ? records.size() / seconds : 0.0, failures);
+    printf("peak rss %ld kB (%ld kB before replay)\n", rss_after, rss_before);
+    print_heap("at peak", peak);
+    print_heap("at end", snapshot(live));
+    return 0;
+}
@@ -1,18 +1,99 @@
 #include <unistd.h>
+#include <cstdint>
 
+// -DMALLOC1_CHUNK_SIZE=<bytes> turns smalloc into a bump allocator: the break grows by whole chunks and requests are
+// served from a cursor inside them, 16 byte aligned, instead of one sbrk per call
+#define MALLOC1_ALIGNMENT 16
+
+#ifdef MALLOC1_CHUNK_SIZE
+static char* chunk_start = NULL; // start of the chunks the cursor runs through
+static char* cursor = NULL;
+static char* chunk_end = NULL; // where the break was left, the cursor can run up to it
+
+// makes room for size bytes at the cursor, false if the break can't move
+static bool _grow(size_t size)
+{
+    char* current_brk = (char*)sbrk(0);
+    char* start = chunk_start;
+    char* next = cursor;
+
+    if (cursor == NULL || current_brk != chunk_end) // first call, or something else moved the break since
+    {
+        next = (char*)(((uintptr_t)current_brk + MALLOC1_ALIGNMENT - 1) & ~(uintptr_t)(MALLOC1_ALIGNMENT - 1));
+        start = next;
+    }
+
+    size_t needed = next + size - current_brk;
+    needed = (needed + MALLOC1_CHUNK_SIZE - 1) / MALLOC1_CHUNK_SIZE * MALLOC1_CHUNK_SIZE;
+    if (sbrk(needed) == (void*)(-1))
+        return false;
+
+    chunk_start = start;
+    cursor = next;
+    chunk_end = current_brk + needed;
+    return true;
+}
+#else
+static char* heap_start = NULL; // where the first smalloc since the break was last moved behind our back started
+static char* heap_end = NULL; // where the last smalloc left the break
+#endif
 
 void* smalloc(size_t size)
 {
     if (size == 0 || size > 100000000)
         return NULL;
-    
+
+#ifdef MALLOC1_CHUNK_SIZE
+    size = (size + MALLOC1_ALIGNMENT - 1) & ~(size_t)(MALLOC1_ALIGNMENT - 1);
+    if ((cursor == NULL || size > (size_t)(chunk_end - cursor)) && !_grow(size))
+        return NULL;
+
+    void* prev_addr = cursor;
+    cursor += size;
+    return prev_addr;
+#else
     void* prev_addr = sbrk(size);
     // void* prev_addr = (void*)(-1);
 
     if (prev_addr == (void*)(-1))
         return NULL;
-    
+
+    if (heap_start == NULL || (char*)prev_addr != heap_end) // first call, or something else moved the break since
+        heap_start = (char*)prev_addr;
+    heap_end = (char*)prev_addr + size;
     return prev_addr;
+#endif
+}
+
+// where the next smalloc would start, for srelease
+void* smark()
+{
+#ifdef MALLOC1_CHUNK_SIZE
+    return cursor; // NULL before the first smalloc, releases everything
+#else
+    return sbrk(0);
+#endif
+}
+
+// frees everything smalloc returned since mark was taken, NULL frees everything. chunks stay ours for the next
+// requests, without MALLOC1_CHUNK_SIZE the break goes back down to mark
+void srelease(void* mark)
+{
+#ifdef MALLOC1_CHUNK_SIZE
+    if (mark == NULL)
+        mark = chunk_start;
+    if ((char*)mark >= chunk_start && (char*)mark <= cursor) // marks from before the break was moved behind our back are stale
+        cursor = (char*)mark;
+#else
+    if (mark == NULL)
+        mark = heap_start;
+    // once the break was moved behind our back, lowering it would free memory that isn't ours
+    if (heap_start == NULL || (char*)sbrk(0) != heap_end || (char*)mark < heap_start || (char*)mark > heap_end)
+        return;
+
+    sbrk(-(intptr_t)(heap_end - (char*)mark));
+    heap_end = (char*)mark;
+#endif
 }
 
 
@@ -1,55 +1,104 @@
 
 #include <unistd.h>
 #include <cstring>
+#include <cstdint>
+#include <sys/mman.h>
 
 #include <cassert>
 #include <iostream>
 
 #define MAX_SIZE 100000000
+#define NUM_SIZE_CLASSES 27 // class i holds free blocks with 2^i <= data_size < 2^(i+1), MAX_SIZE < 2^27.
+                            // coalesced blocks can outgrow MAX_SIZE, the last class takes everything from 2^26 up
+
+// optional behaviour, off by default since the assignment's malloc_2 reuses blocks whole:
+// -DMALLOC2_SPLIT    reused blocks give what the request doesn't need back as a new free block
+// -DMALLOC2_COALESCE freed blocks merge with the free blocks right before and after them
+// -DMALLOC2_WILDERNESS the last block grows by only the missing bytes, for a free one in smalloc and in place in srealloc
+// -DMALLOC2_BEST_FIT  free blocks are kept in a tree by size and smalloc takes the smallest that fits
+// -DMALLOC2_MMAP      requests from MALLOC2_MMAP_THRESHOLD bytes up get their own mapping, unmapped on sfree.
+//                    freeing one raises the threshold to its size (up to MMAP_THRESHOLD_MAX) like glibc does,
+//                    so buffers that keep coming back move to the heap
+// -DMALLOC2_TRIM_THRESHOLD=<bytes> sfree gives a free last block of at least that many bytes back to the system
+#define MIN_SPLIT_DATA_SIZE 128 // smallest data_size worth a block of its own
+#ifndef MALLOC2_MMAP_THRESHOLD
+#define MALLOC2_MMAP_THRESHOLD (128 * 1024)
+#endif
+#define MMAP_THRESHOLD_MAX (32 * 1024 * 1024)
 
 struct MallocMetadata
 {
     size_t data_size;
     size_t block_size; //data_size + sizeof(metadata)
     bool is_free;
+    bool is_mmap; // not in any list
     MallocMetadata *next;
     MallocMetadata *prev;
+    // only while free: links of the size class list, or children in the best fit tree
+    union {MallocMetadata *free_next; MallocMetadata *free_left;};
+    union {MallocMetadata *free_prev; MallocMetadata *free_right;};
 
     static void metadata_init(MallocMetadata* metadata, size_t data_size)
     {
         metadata->data_size = data_size;
         metadata->block_size = data_size + sizeof(MallocMetadata);
         metadata->is_free = false;
+        metadata->is_mmap = false;
         metadata->next = NULL;
         metadata->prev = NULL;
+        metadata->free_next = NULL;
+        metadata->free_prev = NULL;
     }
 };
 
-struct BlockManager{ //could do free list but no optimizations needed..
-    MallocMetadata *head;
+struct BlockManager{
+    MallocMetadata *head; // every block, by address
     MallocMetadata *tail;
+    MallocMetadata *free_lists[NUM_SIZE_CLASSES]; // free blocks by size class, each sorted by address
+    MallocMetadata *free_tree; // MALLOC2_BEST_FIT: free blocks by (data_size, address) instead
     size_t num_free_blocks;
     size_t num_free_bytes;
     size_t num_allocated_blocks;
     size_t num_allocated_bytes;
     size_t num_meta_data_bytes;
     size_t size_meta_data;
+    size_t mmap_threshold;
 
 
     public:
-        BlockManager() : head(NULL), tail(NULL), num_free_blocks(0), num_free_bytes(0), num_allocated_blocks(0), num_allocated_bytes(0), num_meta_data_bytes(0), size_meta_data(sizeof(MallocMetadata)) {};
+        BlockManager() : head(NULL), tail(NULL), free_lists(), free_tree(NULL), num_free_blocks(0), num_free_bytes(0), num_allocated_blocks(0), num_allocated_bytes(0), num_meta_data_bytes(0), size_meta_data(sizeof(MallocMetadata)), mmap_threshold(MALLOC2_MMAP_THRESHOLD) {};
 
-        // return NULL if didn't find
+        // first fit by address (best fit with MALLOC2_BEST_FIT), return NULL if didn't find.
+        // in size's own class only some blocks fit, in every class above it the head is the lowest fitting one
         MallocMetadata *find_free_block(size_t size)
         {
-            MallocMetadata *curr = this->head;
+#ifdef MALLOC2_BEST_FIT
+            MallocMetadata *found = NULL;
+            MallocMetadata *curr = this->free_tree;
             while (curr != NULL)
             {
-                if (curr->is_free == true && size <= curr->data_size)
-                    break;
-                curr = curr->next;
+                if (size <= curr->data_size){
+                    found = curr;
+                    curr = curr->free_left;
+                } else {
+                    curr = curr->free_right;
+                }
             }
-            return curr;
+            return found;
+#else
+            size_t size_class = _size_class(size);
+            MallocMetadata *found = this->free_lists[size_class];
+            while (found != NULL && found->data_size < size)
+                found = found->free_next;
+
+            for (size_t i = size_class + 1; i < NUM_SIZE_CLASSES; i++)
+            {
+                MallocMetadata *curr = this->free_lists[i];
+                if (curr != NULL && (found == NULL || curr < found))
+                    found = curr;
+            }
+            return found;
+#endif
         }
 
         void add(MallocMetadata *metadata)
@@ -70,19 +119,318 @@ struct BlockManager{ //could do free list but no optimizations needed..
             this->num_meta_data_bytes += this->size_meta_data;
         }
 
+        bool use_mmap(size_t size)
+        {
+#ifdef MALLOC2_MMAP
+            return size >= this->mmap_threshold;
+#else
+            (void)size;
+            return false;
+#endif
+        }
+
+        MallocMetadata *mmap_block(size_t size)
+        {
+            void *addr = mmap(NULL, sizeof(MallocMetadata) + size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (addr == MAP_FAILED)
+                return NULL;
+
+            MallocMetadata *metadata = (MallocMetadata*)addr;
+            MallocMetadata::metadata_init(metadata, size);
+            metadata->is_mmap = true;
+            ++(this->num_allocated_blocks);
+            this->num_allocated_bytes += metadata->data_size;
+            this->num_meta_data_bytes += this->size_meta_data;
+            return metadata;
+        }
+
+        void munmap_block(MallocMetadata* metadata)
+        {
+            if (metadata->data_size >= this->mmap_threshold && metadata->data_size < MMAP_THRESHOLD_MAX)
+                this->mmap_threshold = metadata->data_size + 1; // the same size comes from the heap next time
+
+            --(this->num_allocated_blocks);
+            this->num_allocated_bytes -= metadata->data_size;
+            this->num_meta_data_bytes -= this->size_meta_data;
+            munmap(metadata, metadata->block_size);
+        }
+
+        // grows the last block to size by moving the break, false if something else moved it since
+        bool grow_tail(size_t size)
+        {
+#ifdef MALLOC2_WILDERNESS
+            MallocMetadata *metadata = this->tail;
+            if (metadata == NULL || size <= metadata->data_size || (char*)metadata + metadata->block_size != sbrk(0))
+                return false;
+
+            size_t missing = size - metadata->data_size;
+            if (sbrk(missing) == (void *)(-1))
+                return false;
+
+            if (metadata->is_free){
+                _remove_free(metadata);
+                this->num_free_bytes += missing;
+            }
+            metadata->data_size = size;
+            metadata->block_size = size + sizeof(MallocMetadata);
+            this->num_allocated_bytes += missing;
+            if (metadata->is_free)
+                _insert_free(metadata);
+            return true;
+#else
+            (void)size;
+            return false;
+#endif
+        }
+
+        // lowers the break over the free last block, keeping pad bytes of it (none keeps no block at all).
+        // false if there is nothing to give back or something else moved the break since
+        bool trim(size_t pad)
+        {
+            MallocMetadata *metadata = this->tail;
+            if (metadata == NULL || !metadata->is_free || metadata->data_size <= pad || (char*)metadata + metadata->block_size != sbrk(0))
+                return false;
+
+            size_t release = pad == 0 ? metadata->block_size : metadata->data_size - pad;
+            mark_alloc(metadata);
+            if (pad == 0)
+            {
+                this->tail = metadata->prev;
+                if (this->tail != NULL)
+                    this->tail->next = NULL;
+                else
+                    this->head = NULL;
+                --(this->num_allocated_blocks);
+                this->num_allocated_bytes -= metadata->data_size;
+                this->num_meta_data_bytes -= this->size_meta_data;
+            } else
+            {
+                metadata->data_size = pad;
+                metadata->block_size = pad + sizeof(MallocMetadata);
+                this->num_allocated_bytes -= release;
+                mark_free(metadata);
+            }
+            sbrk(-(intptr_t)release);
+            return true;
+        }
+
+        // gives the tail of an allocated block that size doesn't need back as a free block of its own
+        void split(MallocMetadata* metadata, size_t size)
+        {
+#ifdef MALLOC2_SPLIT
+            if (metadata->data_size < size + sizeof(MallocMetadata) + MIN_SPLIT_DATA_SIZE)
+                return;
+
+            MallocMetadata *rest = (MallocMetadata*)((char*)metadata + sizeof(MallocMetadata) + size);
+            MallocMetadata::metadata_init(rest, metadata->data_size - size - sizeof(MallocMetadata));
+            this->num_allocated_bytes -= metadata->data_size - size;
+            metadata->data_size = size;
+            metadata->block_size = size + sizeof(MallocMetadata);
+
+            _link_after(metadata, rest);
+            ++(this->num_allocated_blocks);
+            this->num_allocated_bytes += rest->data_size;
+            this->num_meta_data_bytes += this->size_meta_data;
+            mark_free(rest);
+#else
+            (void)metadata;
+            (void)size;
+#endif
+        }
+
         void mark_free(MallocMetadata* metadata)
         {
             metadata->is_free = true;
+            _insert_free(metadata);
             ++(this->num_free_blocks);
             this-> num_free_bytes += metadata->data_size;
+
+#ifdef MALLOC2_COALESCE
+            if (_is_free_neighbor(metadata, metadata->next))
+                _merge_next(metadata);
+            if (_is_free_neighbor(metadata->prev, metadata))
+                _merge_next(metadata->prev);
+#endif
         }
 
         void mark_alloc(MallocMetadata* metadata)
         {
             metadata->is_free = false;
+            _remove_free(metadata);
             --(this->num_free_blocks);
             this-> num_free_bytes -= metadata->data_size;
         }
+
+    private:
+        void _link_after(MallocMetadata* prev, MallocMetadata* metadata)
+        {
+            metadata->prev = prev;
+            metadata->next = prev->next;
+            if (prev->next != NULL)
+                prev->next->prev = metadata;
+            else
+                this->tail = metadata;
+            prev->next = metadata;
+        }
+
+        // second lies right after first in memory and both are free. something else may have moved the break
+        // between two of our sbrk calls, so list neighbors aren't always memory neighbors
+        bool _is_free_neighbor(MallocMetadata* first, MallocMetadata* second)
+        {
+            return first != NULL && second != NULL && first->is_free && second->is_free &&
+                (char*)first + first->block_size == (char*)second;
+        }
+
+        // metadata absorbs the free block after it, header included
+        void _merge_next(MallocMetadata* metadata)
+        {
+            MallocMetadata *next = metadata->next;
+            _remove_free(metadata);
+            _remove_free(next);
+
+            metadata->data_size += next->block_size;
+            metadata->block_size += next->block_size;
+            metadata->next = next->next;
+            if (next->next != NULL)
+                next->next->prev = metadata;
+            else
+                this->tail = metadata;
+
+            --(this->num_free_blocks);
+            this->num_free_bytes += this->size_meta_data;
+            --(this->num_allocated_blocks);
+            this->num_allocated_bytes += this->size_meta_data;
+            this->num_meta_data_bytes -= this->size_meta_data;
+            _insert_free(metadata);
+        }
+
+        size_t _size_class(size_t size)
+        {
+            size_t size_class = 63 - __builtin_clzl(size);
+            return size_class < NUM_SIZE_CLASSES ? size_class : NUM_SIZE_CLASSES - 1;
+        }
+
+        void _insert_free(MallocMetadata* metadata)
+        {
+#ifdef MALLOC2_BEST_FIT
+            this->free_tree = _tree_insert(this->free_tree, metadata);
+#else
+            MallocMetadata **list = &this->free_lists[_size_class(metadata->data_size)];
+            MallocMetadata *prev = NULL;
+            MallocMetadata *curr = *list;
+            while (curr != NULL && curr < metadata)
+            {
+                prev = curr;
+                curr = curr->free_next;
+            }
+
+            metadata->free_prev = prev;
+            metadata->free_next = curr;
+            if (curr != NULL)
+                curr->free_prev = metadata;
+            if (prev != NULL)
+                prev->free_next = metadata;
+            else
+                *list = metadata;
+#endif
+        }
+
+        void _remove_free(MallocMetadata* metadata)
+        {
+#ifdef MALLOC2_BEST_FIT
+            this->free_tree = _tree_remove(this->free_tree, metadata);
+            metadata->free_left = NULL;
+            metadata->free_right = NULL;
+#else
+            if (metadata->free_prev != NULL)
+                metadata->free_prev->free_next = metadata->free_next;
+            else
+                this->free_lists[_size_class(metadata->data_size)] = metadata->free_next;
+            if (metadata->free_next != NULL)
+                metadata->free_next->free_prev = metadata->free_prev;
+            metadata->free_next = NULL;
+            metadata->free_prev = NULL;
+#endif
+        }
+
+        // the best fit tree is a treap: a search tree on (data_size, address) that is also a heap on a hash of the
+        // address, which keeps it balanced in expectation with nothing but the two child links
+        static bool _tree_less(MallocMetadata* a, MallocMetadata* b)
+        {
+            return a->data_size < b->data_size || (a->data_size == b->data_size && a < b);
+        }
+
+        static uint64_t _tree_priority(MallocMetadata* metadata)
+        {
+            uint64_t hash = (uintptr_t)metadata * 0x9E3779B97F4A7C15ull;
+            return hash ^ (hash >> 29);
+        }
+
+        static MallocMetadata *_rotate_right(MallocMetadata* root)
+        {
+            MallocMetadata *left = root->free_left;
+            root->free_left = left->free_right;
+            left->free_right = root;
+            return left;
+        }
+
+        static MallocMetadata *_rotate_left(MallocMetadata* root)
+        {
+            MallocMetadata *right = root->free_right;
+            root->free_right = right->free_left;
+            right->free_left = root;
+            return right;
+        }
+
+        // both return the new root of the subtree
+        static MallocMetadata *_tree_insert(MallocMetadata* root, MallocMetadata* metadata)
+        {
+            if (root == NULL){
+                metadata->free_left = NULL;
+                metadata->free_right = NULL;
+                return metadata;
+            }
+
+            if (_tree_less(metadata, root)){
+                root->free_left = _tree_insert(root->free_left, metadata);
+                if (_tree_priority(root->free_left) > _tree_priority(root))
+                    root = _rotate_right(root);
+            } else {
+                root->free_right = _tree_insert(root->free_right, metadata);
+                if (_tree_priority(root->free_right) > _tree_priority(root))
+                    root = _rotate_left(root);
+            }
+            return root;
+        }
+
+        // rotates metadata down until it has at most one child, then puts that child in its place
+        static MallocMetadata *_tree_remove(MallocMetadata* root, MallocMetadata* metadata)
+        {
+            if (root == NULL)
+                return NULL;
+
+            if (root != metadata){
+                if (_tree_less(metadata, root))
+                    root->free_left = _tree_remove(root->free_left, metadata);
+                else
+                    root->free_right = _tree_remove(root->free_right, metadata);
+                return root;
+            }
+
+            if (root->free_left == NULL)
+                return root->free_right;
+            if (root->free_right == NULL)
+                return root->free_left;
+
+            if (_tree_priority(root->free_left) > _tree_priority(root->free_right)){
+                root = _rotate_right(root);
+                root->free_right = _tree_remove(root->free_right, metadata);
+            } else {
+                root = _rotate_left(root);
+                root->free_left = _tree_remove(root->free_left, metadata);
+            }
+            return root;
+        }
 };
 
 BlockManager manager = BlockManager();
@@ -97,9 +445,25 @@ void* smalloc(size_t size)
     MallocMetadata* metadata;
     void *base_addr, *data_addr ;
 
+    if (manager.use_mmap(size))
+    {
+        metadata = manager.mmap_block(size);
+        if (metadata == NULL)
+            return NULL;
+        data_addr = (char*)metadata + sizeof(MallocMetadata);
+        return data_addr;
+    }
+
     metadata = manager.find_free_block(size);
     if (metadata != NULL) // found free block
     {
+        manager.mark_alloc(metadata);
+        manager.split(metadata, size);
+        data_addr = (char*)metadata + sizeof(MallocMetadata);
+        return data_addr;
+    } else if (manager.tail != NULL && manager.tail->is_free && manager.grow_tail(size)) // free last block, grown
+    {
+        metadata = manager.tail;
         manager.mark_alloc(metadata);
         data_addr = (char*)metadata + sizeof(MallocMetadata);
         return data_addr;
@@ -140,7 +504,16 @@ void sfree(void* p)
     if (metadata->is_free)
         return;
 
+    if (metadata->is_mmap)
+    {
+        manager.munmap_block(metadata);
+        return;
+    }
     manager.mark_free(metadata);
+#ifdef MALLOC2_TRIM_THRESHOLD
+    if (manager.tail->is_free && manager.tail->data_size >= MALLOC2_TRIM_THRESHOLD)
+        manager.trim(0);
+#endif
 }
 
 void* srealloc(void* oldp, size_t size)
@@ -159,9 +532,24 @@ void* srealloc(void* oldp, size_t size)
         return oldp;
     }
 
-    MallocMetadata* found_metadata = manager.find_free_block(size);
     void* newp;
 
+    if (old_metadata->is_mmap || manager.use_mmap(size)) // to or from a mapping, there is nothing to reuse
+    {
+        newp = smalloc(size);
+        if (newp == NULL)
+            return NULL;
+
+        std::memmove(newp, oldp, old_metadata->data_size);
+        sfree(oldp);
+        return newp;
+    }
+
+    if (old_metadata == manager.tail && manager.grow_tail(size))
+        return oldp;
+
+    MallocMetadata* found_metadata = manager.find_free_block(size);
+
     if (found_metadata == NULL) //didnt find existing block
     {
         newp = smalloc(size);
@@ -177,6 +565,7 @@ void* srealloc(void* oldp, size_t size)
         std::memmove(newp, oldp, old_metadata->data_size);
 
         manager.mark_alloc(found_metadata);
+        manager.split(found_metadata, size);
         manager.mark_free(old_metadata);
         
         return newp;
@@ -184,6 +573,11 @@ void* srealloc(void* oldp, size_t size)
 
 }
 
+int smalloc_trim(size_t pad)
+{
+    return manager.trim(pad) ? 1 : 0;
+}
+
 size_t _num_free_blocks()
 {
     return manager.num_free_blocks;
@@ -2,6 +2,8 @@
 #include <unistd.h>
 #include <cstring>
 #include <cstdint>
+#include <cstddef>
+#include <atomic>
 #include <sys/mman.h>
 
 #include <iostream>
@@ -13,47 +15,155 @@
 #define MAX_BLOCK_SIZE (MIN_BLOCK_SIZE << MAX_ORDER)
 #define TOT_BLOCKS_SIZE (32*MAX_BLOCK_SIZE)
 
+// -DSMALLOC_TRIM_THRESHOLD=<bytes> sfree gives the free superblocks at the top of the heap back to the system once
+// there are at least that many bytes of them. trimmed superblocks come back (up to the original 32) when needed
+
+// free blocks from PURGE_MIN_BLOCK_SIZE up give their pages back with madvise(MADV_DONTNEED), all but the one holding
+// the header, and fault them back in zeroed on reuse. -DSMALLOC_NO_PURGE keeps them resident.
+// the lowest SMALLOC_PURGE_KEEP of the ones sfree left dirty stay resident so a block freed and taken again right
+// away doesn't cost a madvise and a refault every time
+#define PURGE_MIN_BLOCK_SIZE MAX_BLOCK_SIZE
+#ifndef SMALLOC_PURGE_KEEP
+#define SMALLOC_PURGE_KEEP 4
+#endif
+
+// user pointers are SMALLOC_MIN_ALIGNMENT aligned, 16 by default or 64 (cache lines) with -DSMALLOC_MIN_ALIGNMENT=64:
+// blocks start 128 byte or page aligned and HEADER_SIZE is padded up to it
+#ifndef SMALLOC_MIN_ALIGNMENT
+#define SMALLOC_MIN_ALIGNMENT 16
+#endif
+#define HEADER_ALIGN(size) (((size) + SMALLOC_MIN_ALIGNMENT - 1) & ~(size_t)(SMALLOC_MIN_ALIGNMENT - 1))
+
+// -DSMALLOC_COMPACT_HEADER cuts the header an allocated block carries down to HEADER_SIZE bytes: block_size and the
+// flags share one word as bitfields, and the free list links after it live in the payload, so they only
+// hold while the block is free. data_size() is always derived from block_size
+#ifdef SMALLOC_COMPACT_HEADER
+#define HEADER_SIZE HEADER_ALIGN(offsetof(MallocMetadata, next))
+#else
+#define HEADER_SIZE HEADER_ALIGN(sizeof(MallocMetadata))
+#endif
+
 struct MallocMetadata
 {
-    size_t data_size;
-    size_t block_size; //data_size + sizeof(metadata)
+#ifdef SMALLOC_COMPACT_HEADER
+    size_t block_size : 48; //data_size() + HEADER_SIZE
+    bool is_free : 1;
+    bool is_purged : 1; // free, and every page past the first is zero (given back with madvise)
+    bool is_dirty : 1; // free top order block sfree left resident, counted in num_dirty_blocks
+#else
+    size_t block_size; //data_size() + HEADER_SIZE
     bool is_free;
-    MallocMetadata *next;
+    bool is_purged; // free, and every page past the first is zero (given back with madvise)
+    bool is_dirty; // free top order block sfree left resident, counted in num_dirty_blocks
+#endif
+    MallocMetadata *next; // while free
     MallocMetadata *prev;
 
+    size_t data_size() const
+    {
+        return block_size - HEADER_SIZE;
+    }
+
     static void metadata_init(MallocMetadata* metadata, size_t data_size)
     {
-        metadata->data_size = data_size;
-        metadata->block_size = data_size + sizeof(MallocMetadata);
+        metadata->block_size = data_size + HEADER_SIZE;
         metadata->is_free = true;
-        metadata->next = NULL;
-        metadata->prev = NULL;
+        metadata->is_purged = false;
+        metadata->is_dirty = false;
     }
 
+    // the links are left to _insert, they may lie in the data of an allocated block
     static void metadata_init_block(MallocMetadata* metadata, size_t block_size)
     {
         metadata->block_size = block_size;
-        metadata->data_size = block_size - sizeof(MallocMetadata);
         metadata->is_free = true;
-        metadata->next = NULL;
-        metadata->prev = NULL;
+        metadata->is_purged = false;
+        metadata->is_dirty = false;
     }
 };
 
+// any growth here costs every request near an order boundary an order up
+#ifdef SMALLOC_COMPACT_HEADER
+static_assert(offsetof(MallocMetadata, next) == 8, "compact header grew");
+#else
+static_assert(sizeof(MallocMetadata) == 32, "header grew");
+#endif
+
 struct LevelManager{
     MallocMetadata *head;
 };
 
+// stats are sharded by thread so concurrent updates don't bounce a shared cache line, reading sums the shards.
+// the first STAT_SHARDS - 1 threads own a shard and update it with a plain load and store, no locked instruction,
+// later threads share the last one with fetch_add. build with -DSMALLOC_NO_STATS to compile them out (the _num_*
+// functions then return 0)
+#define STAT_SHARDS 16
+
+enum Stat {stat_free_blocks, stat_free_bytes, stat_allocated_blocks, stat_allocated_bytes, stat_meta_data_bytes, NUM_STATS};
+
+struct alignas(64) StatShard{
+    std::atomic<long> values[NUM_STATS];
+};
+
+StatShard stat_shards[STAT_SHARDS];
+
+StatShard* _claim_stat_shard()
+{
+    static std::atomic<int> num_threads(0);
+    int shard = num_threads++;
+    return &stat_shards[shard < STAT_SHARDS - 1 ? shard : STAT_SHARDS - 1];
+}
+
+struct StatCounter{
+    Stat stat;
+
+    StatCounter(Stat stat) : stat(stat) {};
+
+    void add(long value)
+    {
+#ifndef SMALLOC_NO_STATS
+        static thread_local StatShard* shard = NULL; // constant initialized, no tls init guard on every call
+        if (shard == NULL)
+            shard = _claim_stat_shard();
+
+        std::atomic<long>& counter = shard->values[stat];
+        if (shard != &stat_shards[STAT_SHARDS - 1])
+            counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+        else
+            counter.fetch_add(value, std::memory_order_relaxed);
+#else
+        (void)value;
+#endif
+    }
+
+    StatCounter& operator++() { add(1); return *this; }
+    StatCounter& operator--() { add(-1); return *this; }
+    StatCounter& operator+=(size_t value) { add(value); return *this; }
+    StatCounter& operator-=(size_t value) { add(-(long)value); return *this; }
+
+    operator size_t() const
+    {
+        long sum = 0;
+        for (int i = 0; i < STAT_SHARDS; i++)
+            sum += stat_shards[i].values[stat].load(std::memory_order_relaxed);
+        return sum;
+    }
+};
+
 struct BlockManager{ 
     LevelManager level_manager[MAX_ORDER + 2];
-    size_t num_free_blocks;
-    size_t num_free_bytes;
-    size_t num_allocated_blocks;
-    size_t num_allocated_bytes;
-    size_t num_meta_data_bytes;
+    StatCounter num_free_blocks;
+    StatCounter num_free_bytes;
+    StatCounter num_allocated_blocks;
+    StatCounter num_allocated_bytes;
+    StatCounter num_meta_data_bytes;
     size_t size_meta_data;
+    void* heap_base;
+    size_t num_superblocks; // the heap is [heap_base, heap_base + num_superblocks * MAX_BLOCK_SIZE)
+    size_t num_dirty_blocks;
 
-    BlockManager() : num_free_blocks(0), num_free_bytes(0), num_allocated_blocks(0), num_allocated_bytes(0), num_meta_data_bytes(0), size_meta_data(sizeof(MallocMetadata)) {
+    BlockManager() : num_free_blocks(stat_free_blocks), num_free_bytes(stat_free_bytes), num_allocated_blocks(stat_allocated_blocks), num_allocated_bytes(stat_allocated_bytes), num_meta_data_bytes(stat_meta_data_bytes), size_meta_data(HEADER_SIZE),
+        heap_base(NULL), num_superblocks(0), num_dirty_blocks(0) {
         for (int i = 0; i < MAX_ORDER + 2; i++)
         {
             level_manager[i].head = NULL;
@@ -77,6 +187,8 @@ struct BlockManager{
 
         current_brk = sbrk(TOT_BLOCKS_SIZE);
         to_align = (uintptr_t)current_brk % TOT_BLOCKS_SIZE; //just to see its 0
+        heap_base = current_brk;
+        num_superblocks = TOT_BLOCKS_SIZE / MAX_BLOCK_SIZE;
 
         for (size_t i = 0; i < 32; i++)
         {
@@ -94,7 +206,7 @@ struct BlockManager{
         MallocMetadata* found_block;
         size_t lvl = _calc_lvl(size);
         size_t found_lvl = lvl + 1;
-        MallocMetadata* tight_block;
+        MallocMetadata* tight_block = NULL;
 
         if (lvl > MAX_ORDER) // TODO change later
             return NULL;
@@ -124,6 +236,54 @@ struct BlockManager{
         return tight_block;
     }
 
+    // brings back a trimmed superblock, false if none was trimmed or something else moved the break since
+    bool grow()
+    {
+        char* heap_end = (char*)heap_base + num_superblocks * MAX_BLOCK_SIZE;
+        if (heap_base == NULL || num_superblocks == TOT_BLOCKS_SIZE / MAX_BLOCK_SIZE || sbrk(0) != heap_end)
+            return false;
+        if (sbrk(MAX_BLOCK_SIZE) == (void*)(-1))
+            return false;
+
+        MallocMetadata* metadata = (MallocMetadata*)heap_end;
+        MallocMetadata::metadata_init_block(metadata, MAX_BLOCK_SIZE);
+        add_new_block(metadata);
+        ++num_superblocks;
+        return true;
+    }
+
+    // bytes of whole free superblocks at the top of the heap
+    size_t top_free_bytes()
+    {
+        size_t free_superblocks = 0;
+        while (free_superblocks < num_superblocks)
+        {
+            MallocMetadata* metadata = (MallocMetadata*)((char*)heap_base + (num_superblocks - free_superblocks - 1) * MAX_BLOCK_SIZE);
+            if (!metadata->is_free || metadata->block_size != MAX_BLOCK_SIZE)
+                break;
+            ++free_superblocks;
+        }
+        return free_superblocks * MAX_BLOCK_SIZE;
+    }
+
+    // lowers the break over the free superblocks at the top of the heap, keeping pad bytes of them.
+    // false if there is nothing to give back or something else moved the break since
+    bool trim(size_t pad)
+    {
+        size_t free_bytes = top_free_bytes();
+        size_t keep = (pad + MAX_BLOCK_SIZE - 1) / MAX_BLOCK_SIZE * MAX_BLOCK_SIZE;
+        if (free_bytes <= keep || sbrk(0) != (char*)heap_base + num_superblocks * MAX_BLOCK_SIZE)
+            return false;
+
+        for (size_t released = keep; released < free_bytes; released += MAX_BLOCK_SIZE)
+        {
+            --num_superblocks;
+            delete_block((MallocMetadata*)((char*)heap_base + num_superblocks * MAX_BLOCK_SIZE));
+        }
+        sbrk(-(intptr_t)(free_bytes - keep));
+        return true;
+    }
+
     void add_new_block(MallocMetadata *metadata)
     {
         if (metadata == NULL)
@@ -150,21 +310,23 @@ struct BlockManager{
         metadata->is_free = true;
         _insert(metadata);
         ++num_free_blocks;
-        num_free_bytes += metadata->data_size;
+        num_free_bytes += metadata->data_size();
     }
 
     void mark_alloc_bin_block(MallocMetadata *metadata)
     {
         metadata->is_free = false;
+        metadata->is_purged = false;
         _remove(metadata);
         --num_free_blocks;
-        num_free_bytes -= metadata->data_size;
+        num_free_bytes -= metadata->data_size();
     }
 
     MallocMetadata* split_block(MallocMetadata* metadata)
     {
         MallocMetadata* buddy_metadata;
         bool is_free = metadata->is_free;
+        bool is_purged = metadata->is_purged;
         size_t block_size = metadata->block_size;
         size_t new_block_size = block_size >> 1;
         size_t lvl = _calc_lvl(block_size);
@@ -180,6 +342,7 @@ struct BlockManager{
 
         if (is_free == false)
             metadata->is_free = false;
+        metadata->is_purged = buddy_metadata->is_purged = is_purged; // the buddy's header is all its first page holds
         
         add_new_block(metadata);
         add_new_block(buddy_metadata);
@@ -220,7 +383,49 @@ struct BlockManager{
         return new_metadata;
     }
 
-    size_t check_max_block_size_after_joins(MallocMetadata* metadata)
+    // gives the pages of a free block past its first back to the system
+    void purge_block(MallocMetadata* metadata)
+    {
+#ifndef SMALLOC_NO_PURGE
+        static const size_t page_size = sysconf(_SC_PAGESIZE);
+        if (!metadata->is_free || metadata->is_purged || metadata->block_size < PURGE_MIN_BLOCK_SIZE || metadata->block_size <= page_size)
+            return;
+
+        if (madvise((char*)metadata + page_size, metadata->block_size - page_size, MADV_DONTNEED) == 0)
+        {
+            metadata->is_purged = true;
+            _clear_dirty(metadata);
+        }
+#else
+        (void)metadata;
+#endif
+    }
+
+    // called by sfree on the block it ends with: a top order block is left resident, and once more than
+    // SMALLOC_PURGE_KEEP are, the ones above the lowest SMALLOC_PURGE_KEEP are purged (smalloc takes the lowest first)
+    void purge_excess(MallocMetadata* metadata)
+    {
+#ifndef SMALLOC_NO_PURGE
+        if (metadata->block_size < PURGE_MIN_BLOCK_SIZE || metadata->is_purged || metadata->is_dirty)
+            return;
+
+        metadata->is_dirty = true;
+        if (++num_dirty_blocks <= SMALLOC_PURGE_KEEP)
+            return;
+
+        size_t kept = 0;
+        for (MallocMetadata* iter = level_manager[MAX_ORDER].head; iter != NULL; iter = iter->next)
+        {
+            if (iter->is_dirty && ++kept > SMALLOC_PURGE_KEEP)
+                purge_block(iter);
+        }
+#else
+        (void)metadata;
+#endif
+    }
+
+    // keep_address: stop at the first buddy that lies below, so the block would not move
+    size_t check_max_block_size_after_joins(MallocMetadata* metadata, bool keep_address = false)
     {
         MallocMetadata* buddy_metadata;
         MallocMetadata* new_metadata = metadata;
@@ -231,7 +436,7 @@ struct BlockManager{
         {
             size_t lvl = _calc_lvl(new_block_size);
             buddy_metadata = _do_get_buddy(new_metadata, new_block_size);
-        if (lvl >= MAX_ORDER || (_check_if_free(buddy_metadata,new_block_size ) == false)) //can't join
+        if (lvl >= MAX_ORDER || (keep_address && buddy_metadata < new_metadata) || (_check_if_free(buddy_metadata,new_block_size ) == false)) //can't join
         {
             return new_block_size;
         }
@@ -279,6 +484,7 @@ struct BlockManager{
     void _insert(MallocMetadata* metadata)
     {
         size_t lvl = _calc_lvl(metadata->block_size);
+        metadata->next = metadata->prev = NULL;
         MallocMetadata *lvl_head = this->level_manager[lvl].head;
         if (lvl_head == NULL)
         {
@@ -305,8 +511,17 @@ struct BlockManager{
         }
     }
 
+    void _clear_dirty(MallocMetadata* metadata)
+    {
+        if (metadata->is_dirty){
+            metadata->is_dirty = false;
+            --num_dirty_blocks;
+        }
+    }
+
     void _remove(MallocMetadata* metadata)
     {
+        _clear_dirty(metadata);
         size_t lvl = _calc_lvl(metadata->block_size);
         MallocMetadata *prev, *next;
         prev = metadata->prev;
@@ -331,21 +546,21 @@ struct BlockManager{
     {
         if (metadata->is_free){
             ++num_free_blocks;
-            num_free_bytes += metadata->data_size;
+            num_free_bytes += metadata->data_size();
         }
         ++num_allocated_blocks;
-        num_allocated_bytes += metadata->data_size;
-        num_meta_data_bytes += sizeof(MallocMetadata);
+        num_allocated_bytes += metadata->data_size();
+        num_meta_data_bytes += HEADER_SIZE;
     }
     void _data_remove_block(MallocMetadata* metadata)
     {
         if (metadata->is_free){
             --num_free_blocks;
-            num_free_bytes -= metadata->data_size;
+            num_free_bytes -= metadata->data_size();
         }
         --num_allocated_blocks;
-        num_allocated_bytes -= metadata->data_size;
-        num_meta_data_bytes -= sizeof(MallocMetadata);
+        num_allocated_bytes -= metadata->data_size();
+        num_meta_data_bytes -= HEADER_SIZE;
     }
 
     bool _check_if_free(MallocMetadata* block, size_t expected_block_size)
@@ -380,7 +595,7 @@ void* smalloc(size_t size)
         return NULL;
     
     MallocMetadata* metadata;
-    size_t needed_size = size + sizeof(MallocMetadata);
+    size_t needed_size = size + HEADER_SIZE;
     void *metadata_addr, *data_addr ;
 
     if (needed_size > MAX_BLOCK_SIZE) // handle with mmap
@@ -394,18 +609,20 @@ void* smalloc(size_t size)
         metadata->is_free = false;
         manager.add_new_block(metadata);
 
-        data_addr = (char*)metadata_addr + sizeof(MallocMetadata);
+        data_addr = (char*)metadata_addr + HEADER_SIZE;
         return data_addr;
     }
 
     metadata = manager.find_free_block(needed_size);
+    if (metadata == NULL && manager.grow())
+        metadata = manager.find_free_block(needed_size);
     if (metadata == NULL)
         return NULL;
     
 
     manager.mark_alloc_bin_block(metadata);
     
-    data_addr = (char*)metadata + sizeof(MallocMetadata);
+    data_addr = (char*)metadata + HEADER_SIZE;
     return data_addr;
 }
 
@@ -424,7 +641,7 @@ void sfree(void* p)
     if (p == NULL)
         return;
 
-    void* metadata_addr = (char*)p - sizeof(MallocMetadata);
+    void* metadata_addr = (char*)p - HEADER_SIZE;
     MallocMetadata* metadata = (MallocMetadata*)metadata_addr;
 
     if (metadata->is_free)
@@ -438,8 +655,14 @@ void sfree(void* p)
         return;
     }
     manager.mark_free_bin_block(metadata);
-    while ((metadata = manager.join_block_to_buddy(metadata)) != NULL);
-    
+    MallocMetadata* joined;
+    while ((joined = manager.join_block_to_buddy(metadata)) != NULL)
+        metadata = joined;
+    manager.purge_excess(metadata);
+#ifdef SMALLOC_TRIM_THRESHOLD
+    if (manager.top_free_bytes() >= SMALLOC_TRIM_THRESHOLD)
+        manager.trim(0);
+#endif
 }
 
 void* srealloc(void* oldp, size_t size)
@@ -451,8 +674,8 @@ void* srealloc(void* oldp, size_t size)
         return smalloc(size);
 
     void* newp;
-    void* old_metadata_addr = (char*)oldp - sizeof(MallocMetadata);
-    size_t needed_size = size + sizeof(MallocMetadata);
+    void* old_metadata_addr = (char*)oldp - HEADER_SIZE;
+    size_t needed_size = size + HEADER_SIZE;
     MallocMetadata* old_metadata = (MallocMetadata*)old_metadata_addr;
     MallocMetadata* new_metadata;
     size_t new_block_size;
@@ -464,7 +687,7 @@ void* srealloc(void* oldp, size_t size)
             return oldp;
             
         newp = smalloc(size);
-        std::memmove(newp, oldp, old_metadata->data_size);
+        std::memmove(newp, oldp, old_metadata->data_size());
         sfree(oldp);
         return newp;
     }
@@ -481,7 +704,7 @@ void* srealloc(void* oldp, size_t size)
         //     iter = manager.split_block(iter);
         // }
 
-        // newp = (char *)new_metadata + sizeof(MallocMetadata);
+        // newp = (char *)new_metadata + HEADER_SIZE;
         // return newp;
         return oldp;
 
@@ -496,14 +719,14 @@ void* srealloc(void* oldp, size_t size)
             }
 
             new_metadata = iter == NULL ? new_metadata : iter;
-            newp = (char *)new_metadata + sizeof(MallocMetadata);
-            std::memmove(newp, oldp, old_metadata->data_size);
+            newp = (char *)new_metadata + HEADER_SIZE;
+            std::memmove(newp, oldp, old_metadata->data_size());
             return newp;
         }
         else // gets new bin block
         {
             newp = smalloc(size);
-            std::memmove(newp, oldp, old_metadata->data_size);
+            std::memmove(newp, oldp, old_metadata->data_size());
             sfree(oldp);
             return newp;
         }
@@ -512,6 +735,57 @@ void* srealloc(void* oldp, size_t size)
     return NULL;
 }
 
+void* sexpand(void* p, size_t size)
+{
+    if (p == NULL || size == 0 || size > MAX_SIZE)
+        return NULL;
+
+    MallocMetadata* metadata = (MallocMetadata*)((char*)p - HEADER_SIZE);
+    size_t needed_size = size + HEADER_SIZE;
+
+    if (metadata->is_free)
+        return NULL;
+    if (needed_size <= metadata->block_size)
+        return p;
+
+    if (metadata->block_size > MAX_BLOCK_SIZE) // mmap, grow the mapping without letting it move
+    {
+        if (mremap(metadata, metadata->block_size, needed_size, 0) == MAP_FAILED)
+            return NULL;
+
+        manager.delete_block(metadata);
+        metadata->block_size = needed_size;
+        manager.add_new_block(metadata);
+        return p;
+    }
+
+    if (needed_size > MAX_BLOCK_SIZE || manager.check_max_block_size_after_joins(metadata, true) < needed_size)
+        return NULL;
+
+    while (metadata->block_size < needed_size) // buddies all lie above, so metadata stays the block start
+        manager.join_block_to_buddy(metadata);
+
+    return p;
+}
+
+int smalloc_trim(size_t pad)
+{
+    return manager.trim(pad) ? 1 : 0;
+}
+
+size_t smalloc_min_alignment()
+{
+    return SMALLOC_MIN_ALIGNMENT;
+}
+
+int smalloc_largest_free_order()
+{
+    for (int order = MAX_ORDER; order >= 0; order--)
+        if (manager.level_manager[order].head != NULL)
+            return order;
+    return -1;
+}
+
 size_t _num_free_blocks()
 {
     return manager.num_free_blocks;
@@ -2,63 +2,359 @@
 #include <unistd.h>
 #include <cstring>
 #include <cstdint>
+#include <cstddef>
+#include <atomic>
 #include <sys/mman.h>
 #include <fstream>
 #include <string>
+#include <cmath>
+#include <cstdlib>
+#include <cstdio>
+#include <fcntl.h>
+#include <execinfo.h>
+#include <ctime>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#if defined(SMALLOC_LATENCY) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#endif
 
 #include <iostream>
 #include <cassert>
 
+#include "smalloc_ext.h"
+
 #define MAX_SIZE 100000000
 #define MAX_ORDER 10
 #define MIN_BLOCK_SIZE 128
 #define MAX_BLOCK_SIZE (MIN_BLOCK_SIZE << MAX_ORDER)
 #define TOT_BLOCKS_SIZE (32*MAX_BLOCK_SIZE)
-enum Method {as_smalloc, as_scalloc};
+
+// -DSMALLOC_TRIM_THRESHOLD=<bytes> sfree gives the free superblocks at the top of the heap back to the system once
+// there are at least that many bytes of them. trimmed superblocks come back (up to the original 32) when needed
+
+// free blocks from PURGE_MIN_BLOCK_SIZE up give their pages back with madvise(MADV_DONTNEED), all but the one holding
+// the header, and fault them back in zeroed on reuse. -DSMALLOC_NO_PURGE keeps them resident.
+// the lowest SMALLOC_PURGE_KEEP of the ones sfree left dirty stay resident so a block freed and taken again right
+// away doesn't cost a madvise and a refault every time
+#define PURGE_MIN_BLOCK_SIZE MAX_BLOCK_SIZE
+#ifndef SMALLOC_PURGE_KEEP
+#define SMALLOC_PURGE_KEEP 4
+#endif
+
+enum Method : uint8_t {as_smalloc, as_scalloc}; // one byte, so the flags fit the header's second half word
+
+// user pointers are SMALLOC_MIN_ALIGNMENT aligned, 16 by default or 64 (cache lines) with -DSMALLOC_MIN_ALIGNMENT=64:
+// blocks start 128 byte or page aligned and HEADER_SIZE is padded up to it
+#define HEADER_ALIGN(size) (((size) + SMALLOC_MIN_ALIGNMENT - 1) & ~(size_t)(SMALLOC_MIN_ALIGNMENT - 1))
+
+// -DSMALLOC_COMPACT_HEADER cuts the header an allocated block carries down to HEADER_SIZE bytes: block_size and the
+// flags share one word as bitfields, next to the requested size (or prev), and the free list links after it live in the payload, so they only
+// hold while the block is free. data_size() is always derived from block_size
+#ifdef SMALLOC_COMPACT_HEADER
+#define HEADER_SIZE HEADER_ALIGN(offsetof(MallocMetadata, next))
+#else
+#define HEADER_SIZE HEADER_ALIGN(sizeof(MallocMetadata))
+#endif
 
 struct MallocMetadata
 {
-    size_t data_size;
-    size_t block_size; //data_size + sizeof(metadata)
+#ifdef SMALLOC_COMPACT_HEADER
+    size_t block_size : 48; //data_size() + HEADER_SIZE
+    bool is_free : 1;
+    bool is_mmap : 1; // a mapping of its own, not in the buddy heap
+    bool is_huge : 1; // MAP_HUGETLB mapping
+    bool is_sampled : 1; // tracked by the heap profiler
+    bool is_purged : 1; // free, and every page past the first is zero (given back with madvise)
+    bool is_dirty : 1; // free top order block sfree left resident, counted in num_dirty_blocks
+    Method method : 1;
+#else
+    size_t block_size; //data_size() + HEADER_SIZE
     bool is_free;
+    bool is_mmap; // a mapping of its own, not in the buddy heap
+    bool is_huge; // MAP_HUGETLB mapping
+    bool is_sampled; // tracked by the heap profiler
+    bool is_purged; // free, and every page past the first is zero (given back with madvise)
+    bool is_dirty; // free top order block sfree left resident, counted in num_dirty_blocks
     Method method;
-    MallocMetadata *next;
-    MallocMetadata *prev;
+#endif
+    union {
+        MallocMetadata *prev; // while free
+        size_t requested_size; // while allocated
+        MallocMetadata *block; // alias headers (block_size 0): the block they point into
+    };
+    MallocMetadata *next; // while free
+#ifdef SMALLOC_DECAY
+    uint64_t freed_at; // ms, set by sfree on blocks the scavenger may purge (0 = not since it was last inserted)
+#endif
+
+    size_t data_size() const
+    {
+        return block_size - HEADER_SIZE;
+    }
 
     static void metadata_init(MallocMetadata* metadata, size_t data_size)
     {
-        metadata->data_size = data_size;
-        metadata->block_size = data_size + sizeof(MallocMetadata);
+        metadata->block_size = data_size + HEADER_SIZE;
         metadata->is_free = true;
-        metadata->next = NULL;
-        metadata->prev = NULL;
     }
 
+    // the links are left to _insert, they may lie in the data of an allocated block
     static void metadata_init_block(MallocMetadata* metadata, size_t block_size)
     {
         metadata->block_size = block_size;
-        metadata->data_size = block_size - sizeof(MallocMetadata);
         metadata->is_free = true;
+        metadata->is_mmap = false;
+        metadata->is_huge = false;
+        metadata->is_sampled = false;
+        metadata->is_purged = false;
+        metadata->is_dirty = false;
         metadata->method = Method::as_smalloc;
-        metadata->next = NULL;
-        metadata->prev = NULL;
     }
 };
 
+// the flags share a word with block_size: any growth here costs every request near an order boundary an order up
+#ifdef SMALLOC_COMPACT_HEADER
+static_assert(offsetof(MallocMetadata, next) == 16, "compact header grew");
+#elif !defined(SMALLOC_DECAY)
+static_assert(sizeof(MallocMetadata) == 32, "header grew");
+#endif
+
 struct LevelManager{
     MallocMetadata *head;
 };
 
+// stats are sharded by thread so concurrent updates don't bounce a shared cache line, reading sums the shards.
+// the first STAT_SHARDS - 1 threads own a shard and update it with a plain load and store, no locked instruction,
+// later threads share the last one with fetch_add. build with -DSMALLOC_NO_STATS to compile them out (the _num_*
+// functions then return 0)
+#define STAT_SHARDS 16
+
+enum Stat {stat_free_blocks, stat_free_bytes, stat_allocated_blocks, stat_allocated_bytes, stat_meta_data_bytes, stat_splits, stat_joins, stat_sbrk_calls, stat_mmap_calls, stat_munmap_calls, stat_mremap_calls, stat_madvise_calls, stat_mmap_blocks, stat_mmap_bytes, stat_hugetlb_blocks, stat_hugetlb_bytes, stat_requested_bytes, NUM_STATS};
+
+struct alignas(64) StatShard{
+    std::atomic<long> values[NUM_STATS];
+};
+
+StatShard stat_shards[STAT_SHARDS];
+
+StatShard* _claim_stat_shard()
+{
+    static std::atomic<int> num_threads(0);
+    int shard = num_threads++;
+    return &stat_shards[shard < STAT_SHARDS - 1 ? shard : STAT_SHARDS - 1];
+}
+
+struct StatCounter{
+    Stat stat;
+
+    StatCounter(Stat stat) : stat(stat) {};
+
+    void add(long value)
+    {
+#ifndef SMALLOC_NO_STATS
+        static thread_local StatShard* shard = NULL; // constant initialized, no tls init guard on every call
+        if (shard == NULL)
+            shard = _claim_stat_shard();
+
+        std::atomic<long>& counter = shard->values[stat];
+        if (shard != &stat_shards[STAT_SHARDS - 1])
+            counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+        else
+            counter.fetch_add(value, std::memory_order_relaxed);
+#else
+        (void)value;
+#endif
+    }
+
+    StatCounter& operator++() { add(1); return *this; }
+    StatCounter& operator--() { add(-1); return *this; }
+    StatCounter& operator+=(size_t value) { add(value); return *this; }
+    StatCounter& operator-=(size_t value) { add(-(long)value); return *this; }
+
+    operator size_t() const
+    {
+        long sum = 0;
+        for (int i = 0; i < STAT_SHARDS; i++)
+            sum += stat_shards[i].values[stat].load(std::memory_order_relaxed);
+        return sum;
+    }
+};
+
+int _write_all(int fd, const char* buffer, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t written = write(fd, buffer, size);
+        if (written < 0)
+            return -1;
+        buffer += written;
+        size -= written;
+    }
+    return 0;
+}
+
+// per path latency histograms, build with -DSMALLOC_LATENCY to turn them on.
+// the innermost function that knows which path a call took names it with _latency_path, the outermost one to name
+// it wins, and the public entry points time the whole call and add it to that path's histogram
+enum LatencyPath {path_hit, path_split, path_mmap, path_hugetlb_mmap, path_free, path_join, path_munmap, path_realloc_in_place, path_realloc_move, NUM_LATENCY_PATHS};
+
+static const char* const latency_path_names[NUM_LATENCY_PATHS] = {"hit", "split", "mmap", "hugetlb_mmap", "free", "join", "munmap", "realloc_in_place", "realloc_move"};
+
+// log linear buckets like HdrHistogram: every power of two is cut into LATENCY_SUB_BUCKETS, so the error is under 7%
+#define LATENCY_SUB_BITS 4
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BITS)
+#define LATENCY_BUCKETS ((64 - LATENCY_SUB_BITS + 1) * LATENCY_SUB_BUCKETS)
+
+#ifdef SMALLOC_LATENCY
+#if defined(__x86_64__) || defined(__i386__)
+#define LATENCY_UNIT "tsc ticks"
+uint64_t _latency_now() { return __rdtsc(); }
+#else
+#define LATENCY_UNIT "ns"
+uint64_t _latency_now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+#endif
+
+static thread_local int latency_path = -1;
+#endif
+
+void _latency_path(LatencyPath path)
+{
+#ifdef SMALLOC_LATENCY
+    latency_path = path;
+#else
+    (void)path;
+#endif
+}
+
+struct LatencyHistograms{
+    std::atomic<uint64_t> counts[NUM_LATENCY_PATHS][LATENCY_BUCKETS];
+
+    static size_t bucket(uint64_t ticks)
+    {
+        if (ticks < LATENCY_SUB_BUCKETS)
+            return ticks;
+        int shift = 63 - __builtin_clzll(ticks) - LATENCY_SUB_BITS;
+        return (shift + 1) * LATENCY_SUB_BUCKETS + (ticks >> shift) - LATENCY_SUB_BUCKETS;
+    }
+
+    // highest value that lands in bucket
+    static uint64_t bucket_max(size_t bucket)
+    {
+        if (bucket < LATENCY_SUB_BUCKETS)
+            return bucket;
+        int shift = bucket / LATENCY_SUB_BUCKETS - 1;
+        uint64_t sub_bucket = LATENCY_SUB_BUCKETS + bucket % LATENCY_SUB_BUCKETS;
+        return ((sub_bucket + 1) << shift) - 1;
+    }
+
+    void add(int path, uint64_t ticks)
+    {
+        counts[path][bucket(ticks)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void reset()
+    {
+        for (int path = 0; path < NUM_LATENCY_PATHS; path++)
+            for (size_t i = 0; i < LATENCY_BUCKETS; i++)
+                counts[path][i].store(0, std::memory_order_relaxed);
+    }
+
+    int dump(int fd)
+    {
+#ifdef SMALLOC_LATENCY
+        static const double percentiles[] = {0.5, 0.9, 0.99, 0.999, 1};
+        char line[256];
+        int length = snprintf(line, sizeof(line), "latency (" LATENCY_UNIT ")\n%-18s %10s %10s %10s %10s %10s %10s\n",
+            "path", "count", "p50", "p90", "p99", "p99.9", "max");
+        if (_write_all(fd, line, length) != 0)
+            return -1;
+
+        for (int path = 0; path < NUM_LATENCY_PATHS; path++)
+        {
+            uint64_t snapshot[LATENCY_BUCKETS];
+            uint64_t total = 0;
+            for (size_t i = 0; i < LATENCY_BUCKETS; i++)
+                total += snapshot[i] = counts[path][i].load(std::memory_order_relaxed);
+
+            length = snprintf(line, sizeof(line), "%-18s %10llu", latency_path_names[path], (unsigned long long)total);
+            uint64_t seen = 0;
+            size_t i = 0;
+            for (size_t p = 0; p < sizeof(percentiles) / sizeof(percentiles[0]); p++)
+            {
+                if (total == 0){
+                    length += snprintf(line + length, sizeof(line) - length, " %10s", "-");
+                    continue;
+                }
+                uint64_t rank = (uint64_t)std::ceil(percentiles[p] * total);
+                for (; seen + snapshot[i] < rank; i++)
+                    seen += snapshot[i];
+                length += snprintf(line + length, sizeof(line) - length, " %10llu", (unsigned long long)bucket_max(i));
+            }
+            line[length++] = '\n';
+            if (_write_all(fd, line, length) != 0)
+                return -1;
+        }
+        return 0;
+#else
+        (void)fd;
+        return -1;
+#endif
+    }
+};
+
+LatencyHistograms latency;
+
+// times a public entry point from construction to destruction
+struct LatencyTimer{
+#ifdef SMALLOC_LATENCY
+    uint64_t start;
+
+    LatencyTimer() : start(_latency_now()) { latency_path = -1; };
+
+    ~LatencyTimer()
+    {
+        if (latency_path >= 0) // calls that failed early never name a path
+            latency.add(latency_path, _latency_now() - start);
+    }
+#else
+    LatencyTimer() {};
+#endif
+};
+
 struct BlockManager{ 
     LevelManager level_manager[MAX_ORDER + 2];
-    size_t num_free_blocks;
-    size_t num_free_bytes;
-    size_t num_allocated_blocks;
-    size_t num_allocated_bytes;
-    size_t num_meta_data_bytes;
+    StatCounter num_free_blocks;
+    StatCounter num_free_bytes;
+    StatCounter num_allocated_blocks;
+    StatCounter num_allocated_bytes;
+    StatCounter num_meta_data_bytes;
     size_t size_meta_data;
-
-    BlockManager() : num_free_blocks(0), num_free_bytes(0), num_allocated_blocks(0), num_allocated_bytes(0), num_meta_data_bytes(0), size_meta_data(sizeof(MallocMetadata)) {
+    void* heap_base;
+    size_t num_superblocks; // the heap is [heap_base, heap_base + num_superblocks * MAX_BLOCK_SIZE)
+    size_t num_dirty_blocks;
+    StatCounter num_splits;
+    StatCounter num_joins;
+    StatCounter num_sbrk_calls;
+    StatCounter num_mmap_calls;
+    StatCounter num_munmap_calls;
+    StatCounter num_mremap_calls;
+    StatCounter num_madvise_calls;
+    StatCounter num_mmap_blocks;
+    StatCounter num_mmap_bytes;
+    StatCounter num_hugetlb_blocks;
+    StatCounter num_hugetlb_bytes;
+    StatCounter requested_bytes;
+
+    BlockManager() : num_free_blocks(stat_free_blocks), num_free_bytes(stat_free_bytes), num_allocated_blocks(stat_allocated_blocks), num_allocated_bytes(stat_allocated_bytes), num_meta_data_bytes(stat_meta_data_bytes), size_meta_data(HEADER_SIZE),
+        heap_base(NULL), num_superblocks(0), num_dirty_blocks(0), num_splits(stat_splits), num_joins(stat_joins), num_sbrk_calls(stat_sbrk_calls), num_mmap_calls(stat_mmap_calls), num_munmap_calls(stat_munmap_calls), num_mremap_calls(stat_mremap_calls), num_madvise_calls(stat_madvise_calls),
+        num_mmap_blocks(stat_mmap_blocks), num_mmap_bytes(stat_mmap_bytes), num_hugetlb_blocks(stat_hugetlb_blocks), num_hugetlb_bytes(stat_hugetlb_bytes), requested_bytes(stat_requested_bytes) {
         for (int i = 0; i < MAX_ORDER + 2; i++)
         {
             level_manager[i].head = NULL;
@@ -77,11 +373,16 @@ struct BlockManager{
 
         to_align = TOT_BLOCKS_SIZE - (uintptr_t)current_brk%TOT_BLOCKS_SIZE;
 
-        if (to_align != 0)
+        if (to_align != 0){
             sbrk(to_align);
+            ++num_sbrk_calls;
+        }
 
         current_brk = sbrk(TOT_BLOCKS_SIZE);
+        ++num_sbrk_calls;
         to_align = (uintptr_t)current_brk % TOT_BLOCKS_SIZE; //just to see its 0
+        heap_base = current_brk;
+        num_superblocks = TOT_BLOCKS_SIZE / MAX_BLOCK_SIZE;
 
         for (size_t i = 0; i < 32; i++)
         {
@@ -99,14 +400,16 @@ struct BlockManager{
         MallocMetadata* found_block;
         size_t lvl = _calc_lvl(size);
         size_t found_lvl = lvl + 1;
-        MallocMetadata* tight_block;
+        MallocMetadata* tight_block = NULL;
 
         if (lvl > MAX_ORDER) // TODO change later
             return NULL;
         
         found_block = level_manager[lvl].head;
-        if (found_block != NULL)
+        if (found_block != NULL){
+            _latency_path(path_hit);
             return found_block;
+        }
         
 
         while (found_lvl <= MAX_ORDER)
@@ -124,11 +427,61 @@ struct BlockManager{
         {
             tight_block = split_block(found_block);
         }
-        
+        _latency_path(path_split);
 
         return tight_block;
     }
 
+    // brings back a trimmed superblock, false if none was trimmed or something else moved the break since
+    bool grow()
+    {
+        char* heap_end = (char*)heap_base + num_superblocks * MAX_BLOCK_SIZE;
+        if (heap_base == NULL || num_superblocks == TOT_BLOCKS_SIZE / MAX_BLOCK_SIZE || sbrk(0) != heap_end)
+            return false;
+        ++num_sbrk_calls;
+        if (sbrk(MAX_BLOCK_SIZE) == (void*)(-1))
+            return false;
+
+        MallocMetadata* metadata = (MallocMetadata*)heap_end;
+        MallocMetadata::metadata_init_block(metadata, MAX_BLOCK_SIZE);
+        add_new_block(metadata);
+        ++num_superblocks;
+        return true;
+    }
+
+    // bytes of whole free superblocks at the top of the heap
+    size_t top_free_bytes()
+    {
+        size_t free_superblocks = 0;
+        while (free_superblocks < num_superblocks)
+        {
+            MallocMetadata* metadata = (MallocMetadata*)((char*)heap_base + (num_superblocks - free_superblocks - 1) * MAX_BLOCK_SIZE);
+            if (!metadata->is_free || metadata->block_size != MAX_BLOCK_SIZE)
+                break;
+            ++free_superblocks;
+        }
+        return free_superblocks * MAX_BLOCK_SIZE;
+    }
+
+    // lowers the break over the free superblocks at the top of the heap, keeping pad bytes of them.
+    // false if there is nothing to give back or something else moved the break since
+    bool trim(size_t pad)
+    {
+        size_t free_bytes = top_free_bytes();
+        size_t keep = (pad + MAX_BLOCK_SIZE - 1) / MAX_BLOCK_SIZE * MAX_BLOCK_SIZE;
+        if (free_bytes <= keep || sbrk(0) != (char*)heap_base + num_superblocks * MAX_BLOCK_SIZE)
+            return false;
+
+        for (size_t released = keep; released < free_bytes; released += MAX_BLOCK_SIZE)
+        {
+            --num_superblocks;
+            delete_block((MallocMetadata*)((char*)heap_base + num_superblocks * MAX_BLOCK_SIZE));
+        }
+        sbrk(-(intptr_t)(free_bytes - keep));
+        ++num_sbrk_calls;
+        return true;
+    }
+
     void add_new_block(MallocMetadata *metadata)
     {
         if (metadata == NULL)
@@ -155,15 +508,16 @@ struct BlockManager{
         metadata->is_free = true;
         _insert(metadata);
         ++num_free_blocks;
-        num_free_bytes += metadata->data_size;
+        num_free_bytes += metadata->data_size();
     }
 
     void mark_alloc_bin_block(MallocMetadata *metadata)
     {
         metadata->is_free = false;
+        metadata->is_purged = false;
         _remove(metadata);
         --num_free_blocks;
-        num_free_bytes -= metadata->data_size;
+        num_free_bytes -= metadata->data_size();
     }
 
     MallocMetadata* split_block(MallocMetadata* metadata)
@@ -171,6 +525,9 @@ struct BlockManager{
         MallocMetadata* buddy_metadata;
         bool is_free = metadata->is_free;
         Method method = metadata->method;
+        bool is_sampled = metadata->is_sampled;
+        bool is_purged = metadata->is_purged;
+        size_t requested_size = is_free ? 0 : metadata->requested_size;
         size_t block_size = metadata->block_size;
         size_t new_block_size = block_size >> 1;
         size_t lvl = _calc_lvl(block_size);
@@ -179,14 +536,19 @@ struct BlockManager{
             return NULL;
 
         delete_block(metadata);
+        ++num_splits;
 
         MallocMetadata::metadata_init_block(metadata, new_block_size);
         buddy_metadata  = _get_buddy(metadata);
         MallocMetadata::metadata_init_block(buddy_metadata,new_block_size);
 
         metadata->method = method;
-        if (is_free == false)
+        metadata->is_sampled = is_sampled;
+        if (is_free == false){
             metadata->is_free = false;
+            metadata->requested_size = requested_size;
+        }
+        metadata->is_purged = buddy_metadata->is_purged = is_purged; // the buddy's header is all its first page holds
         
         add_new_block(metadata);
         add_new_block(buddy_metadata);
@@ -202,6 +564,8 @@ struct BlockManager{
 
         bool is_free = metadata->is_free;
         Method method = metadata->method;
+        bool is_sampled = metadata->is_sampled;
+        size_t requested_size = is_free ? 0 : metadata->requested_size;
         size_t block_size = metadata->block_size;
         size_t new_block_size = metadata->block_size << 1;
         size_t lvl = _calc_lvl(block_size);
@@ -217,19 +581,24 @@ struct BlockManager{
 
         delete_block(metadata);
         delete_block(buddy_metadata);
+        ++num_joins;
 
         MallocMetadata::metadata_init_block(new_metadata, new_block_size);
 
         new_metadata->method = method;
-        if (is_free == false)
+        new_metadata->is_sampled = is_sampled;
+        if (is_free == false){
             new_metadata->is_free = false;
+            new_metadata->requested_size = requested_size;
+        }
 
         add_new_block(new_metadata);
         
         return new_metadata;
     }
 
-    size_t check_max_block_size_after_joins(MallocMetadata* metadata)
+    // keep_address: stop at the first buddy that lies below, so the block would not move
+    size_t check_max_block_size_after_joins(MallocMetadata* metadata, bool keep_address = false)
     {
         MallocMetadata* buddy_metadata;
         MallocMetadata* new_metadata = metadata;
@@ -240,7 +609,7 @@ struct BlockManager{
         {
             size_t lvl = _calc_lvl(new_block_size);
             buddy_metadata = _do_get_buddy(new_metadata, new_block_size);
-        if (lvl >= MAX_ORDER || (_check_if_free(buddy_metadata,new_block_size ) == false)) //can't join
+        if (lvl >= MAX_ORDER || (keep_address && buddy_metadata < new_metadata) || (_check_if_free(buddy_metadata,new_block_size ) == false)) //can't join
         {
             return new_block_size;
         }
@@ -250,6 +619,139 @@ struct BlockManager{
         }
     }
 
+    void set_requested_size(MallocMetadata* metadata, size_t size)
+    {
+        requested_bytes += size;
+        requested_bytes -= metadata->requested_size;
+        metadata->requested_size = size;
+    }
+
+    // gives the pages of a free block past its first back to the system
+    void purge_block(MallocMetadata* metadata)
+    {
+#ifndef SMALLOC_NO_PURGE
+        static const size_t page_size = sysconf(_SC_PAGESIZE);
+        if (!metadata->is_free || metadata->is_purged || metadata->block_size < PURGE_MIN_BLOCK_SIZE || metadata->block_size <= page_size)
+            return;
+
+        ++num_madvise_calls;
+        if (madvise((char*)metadata + page_size, metadata->block_size - page_size, MADV_DONTNEED) == 0)
+        {
+            metadata->is_purged = true;
+            _clear_dirty(metadata);
+        }
+#else
+        (void)metadata;
+#endif
+    }
+
+    // called by sfree on the block it ends with: a top order block is left resident, and once more than
+    // SMALLOC_PURGE_KEEP are, the ones above the lowest SMALLOC_PURGE_KEEP are purged (smalloc takes the lowest first)
+    void purge_excess(MallocMetadata* metadata)
+    {
+#ifndef SMALLOC_NO_PURGE
+        if (metadata->block_size < PURGE_MIN_BLOCK_SIZE || metadata->is_purged || metadata->is_dirty)
+            return;
+
+        metadata->is_dirty = true;
+        if (++num_dirty_blocks <= SMALLOC_PURGE_KEEP)
+            return;
+
+        size_t kept = 0;
+        for (MallocMetadata* iter = level_manager[MAX_ORDER].head; iter != NULL; iter = iter->next)
+        {
+            if (iter->is_dirty && ++kept > SMALLOC_PURGE_KEEP)
+                purge_block(iter);
+        }
+#else
+        (void)metadata;
+#endif
+    }
+
+#ifdef SMALLOC_DECAY
+    // purges the free top order blocks freed before freed_before, at most max_purges of them
+    size_t purge_decayed(uint64_t freed_before, size_t max_purges)
+    {
+        size_t purges = 0;
+        for (MallocMetadata* iter = level_manager[MAX_ORDER].head; iter != NULL && purges < max_purges; iter = iter->next)
+        {
+            if (iter->is_purged || iter->freed_at == 0 || iter->freed_at > freed_before)
+                continue;
+            purge_block(iter);
+            ++purges;
+        }
+        return purges;
+    }
+#endif
+
+    // bytes at the start of the data that may not be zero, all of it unless the block was purged
+    size_t dirty_size(MallocMetadata* metadata)
+    {
+        static const size_t page_size = sysconf(_SC_PAGESIZE);
+        size_t header_page = page_size - ((uintptr_t)metadata + HEADER_SIZE) % page_size;
+        if (!metadata->is_purged || header_page > metadata->data_size())
+            return metadata->data_size();
+        return header_page;
+    }
+
+    // walks every block of the heap, block_bytes gets the size of the used ones, purged_bytes what was given back
+    void count_orders(size_t* free_blocks, size_t* used_blocks, size_t* block_bytes, size_t* purged_bytes)
+    {
+        if (heap_base == NULL)
+            return;
+
+        char* iter = (char*)heap_base;
+        char* end = iter + num_superblocks * MAX_BLOCK_SIZE;
+        while (iter < end)
+        {
+            MallocMetadata* metadata = (MallocMetadata*)iter;
+            size_t lvl = _calc_lvl(metadata->block_size);
+            if (metadata->is_free){
+                ++free_blocks[lvl];
+                if (metadata->is_purged)
+                    *purged_bytes += metadata->data_size() - dirty_size(metadata);
+            } else {
+                ++used_blocks[lvl];
+                *block_bytes += metadata->block_size;
+            }
+            iter += metadata->block_size;
+        }
+    }
+
+    int dump_heap(int fd)
+    {
+        SmallocHeapHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, SMALLOC_HEAP_MAGIC, sizeof(header.magic));
+        header.heap_base = (uintptr_t)heap_base;
+        header.superblocks = num_superblocks;
+        header.superblock_size = MAX_BLOCK_SIZE;
+        header.min_block_size = MIN_BLOCK_SIZE;
+        if (_write_all(fd, (const char*)&header, sizeof(header)) != 0)
+            return -1;
+
+        for (uint32_t i = 0; i < header.superblocks; i++)
+        {
+            struct {
+                uint32_t num_blocks;
+                uint8_t blocks[MAX_BLOCK_SIZE / MIN_BLOCK_SIZE];
+            } superblock;
+
+            char* iter = (char*)heap_base + i * MAX_BLOCK_SIZE;
+            char* end = iter + MAX_BLOCK_SIZE;
+            superblock.num_blocks = 0;
+            while (iter < end)
+            {
+                MallocMetadata* metadata = (MallocMetadata*)iter;
+                superblock.blocks[superblock.num_blocks++] = _calc_lvl(metadata->block_size) | (metadata->is_free ? 0 : SMALLOC_HEAP_USED);
+                iter += metadata->block_size;
+            }
+
+            if (_write_all(fd, (const char*)&superblock, sizeof(uint32_t) + superblock.num_blocks) != 0)
+                return -1;
+        }
+        return 0;
+    }
 
     private:
 
@@ -288,6 +790,10 @@ struct BlockManager{
     void _insert(MallocMetadata* metadata)
     {
         size_t lvl = _calc_lvl(metadata->block_size);
+        metadata->next = metadata->prev = NULL; // prev may still hold the requested size
+#ifdef SMALLOC_DECAY
+        metadata->freed_at = 0;
+#endif
         MallocMetadata *lvl_head = this->level_manager[lvl].head;
         if (lvl_head == NULL)
         {
@@ -314,8 +820,17 @@ struct BlockManager{
         }
     }
 
+    void _clear_dirty(MallocMetadata* metadata)
+    {
+        if (metadata->is_dirty){
+            metadata->is_dirty = false;
+            --num_dirty_blocks;
+        }
+    }
+
     void _remove(MallocMetadata* metadata)
     {
+        _clear_dirty(metadata);
         size_t lvl = _calc_lvl(metadata->block_size);
         MallocMetadata *prev, *next;
         prev = metadata->prev;
@@ -340,21 +855,35 @@ struct BlockManager{
     {
         if (metadata->is_free){
             ++num_free_blocks;
-            num_free_bytes += metadata->data_size;
+            num_free_bytes += metadata->data_size();
         }
         ++num_allocated_blocks;
-        num_allocated_bytes += metadata->data_size;
-        num_meta_data_bytes += sizeof(MallocMetadata);
+        num_allocated_bytes += metadata->data_size();
+        num_meta_data_bytes += HEADER_SIZE;
+        if (metadata->is_mmap && metadata->is_huge){
+            ++num_hugetlb_blocks;
+            num_hugetlb_bytes += metadata->block_size;
+        } else if (metadata->is_mmap){
+            ++num_mmap_blocks;
+            num_mmap_bytes += metadata->block_size;
+        }
     }
     void _data_remove_block(MallocMetadata* metadata)
     {
         if (metadata->is_free){
             --num_free_blocks;
-            num_free_bytes -= metadata->data_size;
+            num_free_bytes -= metadata->data_size();
         }
         --num_allocated_blocks;
-        num_allocated_bytes -= metadata->data_size;
-        num_meta_data_bytes -= sizeof(MallocMetadata);
+        num_allocated_bytes -= metadata->data_size();
+        num_meta_data_bytes -= HEADER_SIZE;
+        if (metadata->is_mmap && metadata->is_huge){
+            --num_hugetlb_blocks;
+            num_hugetlb_bytes -= metadata->block_size;
+        } else if (metadata->is_mmap){
+            --num_mmap_blocks;
+            num_mmap_bytes -= metadata->block_size;
+        }
     }
 
     bool _check_if_free(MallocMetadata* block, size_t expected_block_size)
@@ -375,6 +904,415 @@ struct BlockManager{
 
 BlockManager manager = BlockManager();
 
+// -DSMALLOC_DECAY moves purging off the free path: sfree leaves blocks resident and a background thread purges the
+// ones that stayed free for the decay time (SMALLOC_DECAY_MS=<ms> or smalloc_decay_ms, DEFAULT_DECAY_MS otherwise),
+// at most DECAY_MAX_PURGES per tick. every call then runs under the allocator lock, recursive as calls nest
+#define DEFAULT_DECAY_MS 10000
+#define DECAY_TICKS 8 // per decay time
+#define DECAY_MAX_PURGES 4
+
+#ifdef SMALLOC_DECAY
+std::recursive_mutex allocator_lock;
+#endif
+
+struct AllocatorLock{
+#ifdef SMALLOC_DECAY
+    AllocatorLock() { allocator_lock.lock(); };
+    ~AllocatorLock() { allocator_lock.unlock(); };
+#else
+    AllocatorLock() {};
+#endif
+};
+
+uint64_t _decay_now_ms()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+struct Scavenger{
+    std::atomic<size_t> decay_ms;
+
+    Scavenger() : decay_ms(DEFAULT_DECAY_MS) {};
+
+    void start()
+    {
+#ifdef SMALLOC_DECAY
+        const char* decay = getenv("SMALLOC_DECAY_MS");
+        if (decay != NULL)
+            decay_ms = strtoul(decay, NULL, 10);
+        std::thread(&Scavenger::run, this).detach();
+#endif
+    }
+
+    void run()
+    {
+#ifdef SMALLOC_DECAY
+        while (true)
+        {
+            size_t tick_ms = decay_ms / DECAY_TICKS;
+            std::this_thread::sleep_for(std::chrono::milliseconds(tick_ms == 0 ? 1 : tick_ms));
+
+            AllocatorLock lock;
+            uint64_t now = _decay_now_ms();
+            if (now >= decay_ms)
+                manager.purge_decayed(now - decay_ms, DECAY_MAX_PURGES);
+        }
+#endif
+    }
+};
+
+Scavenger scavenger;
+
+#define PROF_MAX_SAMPLES 4096 // power of two, open addressing table
+#define PROF_MAX_FRAMES 32
+#define PROF_TOMBSTONE ((MallocMetadata*)1)
+#define PROF_MAX_TOMBSTONES (PROF_MAX_SAMPLES / 4) // past it the table is rebuilt, lookups would probe ever longer
+
+struct ProfSample{
+    MallocMetadata* metadata;
+    size_t size;
+    int depth;
+    void* frames[PROF_MAX_FRAMES];
+};
+
+// samples an allocation every sample_bytes bytes on average (exponentially distributed gaps),
+// the live samples are keyed by their block's metadata
+struct HeapProfiler{
+    size_t sample_bytes; // 0 = off
+    long bytes_until_sample;
+    uint64_t rng;
+    size_t num_samples;
+    size_t num_dropped;
+    size_t num_tombstones;
+    ProfSample samples[PROF_MAX_SAMPLES];
+
+    HeapProfiler() : sample_bytes(0), bytes_until_sample(0), rng(0x9E3779B97F4A7C15ULL), num_samples(0), num_dropped(0), num_tombstones(0) {};
+
+    void set_sample_bytes(size_t bytes)
+    {
+        sample_bytes = bytes;
+        bytes_until_sample = _next_gap();
+    }
+
+    void on_alloc(MallocMetadata* metadata, size_t size)
+    {
+        bytes_until_sample -= size;
+        if (bytes_until_sample > 0)
+            return;
+        bytes_until_sample = _next_gap();
+
+        ProfSample* sample = _insert_slot(metadata);
+        if (sample == NULL){
+            ++num_dropped;
+            return;
+        }
+
+        void* frames[PROF_MAX_FRAMES + 2];
+        int depth = backtrace(frames, PROF_MAX_FRAMES + 2) - 2; // skip on_alloc and _smalloc
+        if (depth < 0)
+            depth = 0;
+
+        sample->metadata = metadata;
+        sample->size = size;
+        sample->depth = depth;
+        std::memcpy(sample->frames, frames + 2, depth * sizeof(void*));
+        metadata->is_sampled = true;
+        ++num_samples;
+    }
+
+    void on_free(MallocMetadata* metadata)
+    {
+        ProfSample* sample = _find_slot(metadata);
+        metadata->is_sampled = false;
+        if (sample == NULL)
+            return;
+
+        --num_samples;
+        _remove_slot(sample);
+    }
+
+    // the block's metadata moved (srealloc joined it with a lower buddy)
+    void on_move(MallocMetadata* old_metadata, MallocMetadata* new_metadata)
+    {
+        ProfSample* sample = _find_slot(old_metadata);
+        if (sample == NULL)
+            return;
+
+        ProfSample moved = *sample;
+        _remove_slot(sample);
+        sample = _insert_slot(new_metadata); // can't fail, the old slot is free now
+        *sample = moved;
+        sample->metadata = new_metadata;
+    }
+
+    // pprof's legacy heap profile format, counts are the raw samples
+    int dump(int fd)
+    {
+        char line[64 + PROF_MAX_FRAMES * 20];
+        size_t total_bytes = 0;
+        int len;
+
+        for (size_t i = 0; i < PROF_MAX_SAMPLES; i++)
+        {
+            if (_is_live(&samples[i]))
+                total_bytes += samples[i].size;
+        }
+
+        len = snprintf(line, sizeof(line), "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%zu\n",
+            num_samples, total_bytes, num_samples, total_bytes, sample_bytes);
+        if (_write_all(fd, line, len) < 0)
+            return -1;
+
+        for (size_t i = 0; i < PROF_MAX_SAMPLES; i++)
+        {
+            ProfSample* sample = &samples[i];
+            if (_is_live(sample) == false)
+                continue;
+
+            len = snprintf(line, sizeof(line), "1: %zu [1: %zu] @", sample->size, sample->size);
+            for (int j = 0; j < sample->depth; j++)
+                len += snprintf(line + len, sizeof(line) - len, " %p", sample->frames[j]);
+            len += snprintf(line + len, sizeof(line) - len, "\n");
+            if (_write_all(fd, line, len) < 0)
+                return -1;
+        }
+
+        // lets pprof symbolize the addresses
+        static const char maps_header[] = "\nMAPPED_LIBRARIES:\n";
+        if (_write_all(fd, maps_header, sizeof(maps_header) - 1) < 0)
+            return -1;
+        int maps = open("/proc/self/maps", O_RDONLY);
+        if (maps < 0)
+            return 0;
+        char buffer[4096];
+        ssize_t read_bytes;
+        while ((read_bytes = read(maps, buffer, sizeof(buffer))) > 0)
+        {
+            if (_write_all(fd, buffer, read_bytes) < 0)
+                break;
+        }
+        close(maps);
+        return 0;
+    }
+
+    private:
+
+    long _next_gap()
+    {
+        if (sample_bytes == 0)
+            return 0;
+
+        // xorshift64, then inverse transform of an exponential with mean sample_bytes
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+        double uniform = ((rng >> 11) + 1) * (1.0 / 9007199254740993.0); // (0, 1]
+        return (long)(-std::log(uniform) * sample_bytes) + 1;
+    }
+
+    bool _is_live(ProfSample* sample)
+    {
+        return sample->metadata != NULL && sample->metadata != PROF_TOMBSTONE;
+    }
+
+    // insert: find a slot to put metadata in instead of its sample
+    ProfSample* _find_slot(MallocMetadata* metadata, bool insert = false)
+    {
+        size_t start = ((uintptr_t)metadata >> 7) & (PROF_MAX_SAMPLES - 1);
+        for (size_t i = 0; i < PROF_MAX_SAMPLES; i++)
+        {
+            ProfSample* sample = &samples[(start + i) & (PROF_MAX_SAMPLES - 1)];
+            if (insert && _is_live(sample) == false)
+                return sample;
+            if (sample->metadata == metadata)
+                return sample;
+            if (sample->metadata == NULL)
+                return NULL;
+        }
+        return NULL;
+    }
+
+    ProfSample* _insert_slot(MallocMetadata* metadata)
+    {
+        ProfSample* sample = _find_slot(metadata, true);
+        if (sample != NULL && sample->metadata == PROF_TOMBSTONE)
+            --num_tombstones;
+        return sample;
+    }
+
+    void _remove_slot(ProfSample* sample)
+    {
+        sample->metadata = PROF_TOMBSTONE;
+        if (++num_tombstones > PROF_MAX_TOMBSTONES)
+            _rehash();
+    }
+
+    // reinserts the live samples into an empty table, from a copy in a mapping of its own since the heap is ours
+    void _rehash()
+    {
+        void* addr = mmap(NULL, sizeof(samples), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (addr == MAP_FAILED)
+            return;
+
+        ProfSample* old_samples = (ProfSample*)addr;
+        std::memcpy(old_samples, samples, sizeof(samples));
+        for (size_t i = 0; i < PROF_MAX_SAMPLES; i++)
+            samples[i].metadata = NULL;
+        num_tombstones = 0;
+
+        for (size_t i = 0; i < PROF_MAX_SAMPLES; i++)
+        {
+            if (_is_live(&old_samples[i]))
+                *_find_slot(old_samples[i].metadata, true) = old_samples[i];
+        }
+        munmap(addr, sizeof(samples));
+    }
+};
+
+HeapProfiler profiler;
+
+void _prof_dump_at_exit()
+{
+    const char* path = getenv("SMALLOC_PROF_FILE");
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return;
+    profiler.dump(fd);
+    close(fd);
+}
+
+void _prof_init()
+{
+    const char* sample_bytes = getenv("SMALLOC_PROF_SAMPLE");
+    if (sample_bytes != NULL)
+        profiler.set_sample_bytes(strtoul(sample_bytes, NULL, 10));
+    if (getenv("SMALLOC_PROF_FILE") != NULL)
+        atexit(_prof_dump_at_exit);
+}
+
+#define TRACE_BUFFER_RECORDS 4096
+
+struct TraceBuffer{
+    size_t num_records;
+    SmallocTraceRecord records[TRACE_BUFFER_RECORDS];
+};
+
+// logs every call to a per thread buffer that is appended to the trace file when full and when the thread exits
+struct TraceRecorder{
+    int fd; // -1 = off
+    uint64_t start_ns;
+
+    TraceRecorder() : fd(-1), start_ns(0) {};
+
+    void open_file(const char* path)
+    {
+        SmallocTraceHeader header;
+        std::memcpy(header.magic, SMALLOC_TRACE_MAGIC, sizeof(header.magic));
+        header.record_size = sizeof(SmallocTraceRecord);
+
+        fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+        if (fd >= 0 && write(fd, &header, sizeof(header)) != sizeof(header)){
+            close(fd);
+            fd = -1;
+        }
+        start_ns = _now_ns();
+    }
+
+    void record(uint8_t op, void* ptr, void* old_ptr, size_t size, int flags = 0)
+    {
+        if (fd < 0)
+            return;
+
+        // without a buffer (mmap failed, or the thread's buffer is already torn down) the record goes straight out
+        TraceBuffer* buffer = _thread_buffer();
+        SmallocTraceRecord direct;
+        SmallocTraceRecord* record = buffer != NULL ? &buffer->records[buffer->num_records++] : &direct;
+        record->timestamp = _now_ns() - start_ns;
+        record->ptr = (uintptr_t)ptr;
+        record->old_ptr = (uintptr_t)old_ptr;
+        record->size = size;
+        record->op = op;
+        record->pad = 0;
+        record->flags = flags;
+
+        if (buffer == NULL)
+            _write_records(record, 1);
+        else if (buffer->num_records == TRACE_BUFFER_RECORDS)
+            flush(buffer);
+    }
+
+    void flush(TraceBuffer* buffer)
+    {
+        _write_records(buffer->records, buffer->num_records);
+        buffer->num_records = 0;
+    }
+
+    private:
+
+    struct ThreadBuffer{
+        TraceBuffer* buffer;
+
+        ThreadBuffer() : buffer(NULL) {};
+        ~ThreadBuffer();
+    };
+
+    // static destructors may still allocate after the thread's buffer is gone. kept outside ThreadBuffer,
+    // stores to a destroyed object don't have to stick
+    static thread_local bool thread_torn_down;
+
+    void _write_records(SmallocTraceRecord* records, size_t num_records)
+    {
+        // O_APPEND keeps the flushes of different threads from interleaving
+        size_t size = num_records * sizeof(SmallocTraceRecord);
+        if (fd >= 0 && size > 0 && write(fd, records, size) != (ssize_t)size){
+            close(fd); // stop tracing rather than leave a torn record behind
+            fd = -1;
+        }
+    }
+
+    TraceBuffer* _thread_buffer()
+    {
+        static thread_local ThreadBuffer thread_buffer;
+        if (thread_torn_down)
+            return NULL;
+        if (thread_buffer.buffer == NULL){
+            void* addr = mmap(NULL, sizeof(TraceBuffer), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (addr != MAP_FAILED)
+                thread_buffer.buffer = (TraceBuffer*)addr;
+        }
+        return thread_buffer.buffer;
+    }
+
+    uint64_t _now_ns()
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+    }
+};
+
+thread_local bool TraceRecorder::thread_torn_down = false;
+TraceRecorder tracer;
+
+TraceRecorder::ThreadBuffer::~ThreadBuffer()
+{
+    thread_torn_down = true;
+    if (buffer == NULL)
+        return;
+    tracer.flush(buffer);
+    munmap(buffer, sizeof(TraceBuffer));
+    buffer = NULL;
+}
+
+void _trace_init()
+{
+    const char* path = getenv("SMALLOC_TRACE_FILE");
+    if (path != NULL)
+        tracer.open_file(path);
+}
+
 long getHugePageSize() {
     std::ifstream meminfo("/proc/meminfo");
     std::string line;
@@ -393,6 +1331,17 @@ long getHugePageSize() {
     return size;
 }
 
+// 0 when /proc/meminfo has no Hugepagesize (no hugetlb support), or when built with -DSMALLOC_NO_HUGETLB
+size_t _hugepage_size()
+{
+#ifdef SMALLOC_NO_HUGETLB
+    return 0;
+#else
+    static const size_t hugepage_size = getHugePageSize();
+    return hugepage_size;
+#endif
+}
+
 size_t _align_size(size_t size, size_t to) {
     if (size % to == 0)
         return size;
@@ -401,12 +1350,50 @@ size_t _align_size(size_t size, size_t to) {
     return size + add;
 }
 
-void* _smalloc(size_t size, Method method = Method::as_smalloc, size_t calloc_block_size = 0 )
+// saligned_alloc places an alias header (block_size 0, next -> real header) right before the aligned pointer
+MallocMetadata* _get_metadata(void* p)
+{
+    MallocMetadata* metadata = (MallocMetadata*)((char*)p - HEADER_SIZE);
+    if (metadata->block_size == 0)
+        return metadata->block;
+    return metadata;
+}
+
+bool _use_hugepage(size_t size, Method method, size_t calloc_block_size, int flags)
+{
+    if (_hugepage_size() == 0) // even SMALLOCX_HUGEPAGE falls back to a normal mapping
+        return false;
+    if (flags & SMALLOCX_HUGEPAGE)
+        return true;
+    if (flags & SMALLOCX_NO_HUGEPAGE)
+        return false;
+
+    if (method == Method::as_smalloc)
+        return size >= (1 << 22); // 4MB
+    return calloc_block_size > (1 << 20); //2MB
+}
+
+// touch every page so the first real access doesn't fault
+void _prefault(void* addr, size_t size)
+{
+    static const long page_size = sysconf(_SC_PAGESIZE);
+    volatile char* iter = (volatile char*)addr;
+    volatile char* end = iter + size;
+
+    for (; iter < end; iter += page_size)
+        *iter = *iter;
+    *(end - 1) = *(end - 1);
+}
+
+void* _smalloc(size_t size, Method method = Method::as_smalloc, size_t calloc_block_size = 0, int flags = 0)
 {
     
     static bool to_alloc = true;
     if (to_alloc){
         manager.init();
+        _prof_init();
+        _trace_init();
+        scavenger.start();
         to_alloc = false;
     }
 
@@ -414,92 +1401,126 @@ void* _smalloc(size_t size, Method method = Method::as_smalloc, size_t calloc_bl
         return NULL;
     
     MallocMetadata* metadata;
-    size_t needed_size = size + sizeof(MallocMetadata);
+    size_t needed_size = size + HEADER_SIZE;
     void *metadata_addr, *data_addr ;
 
-    if (needed_size > MAX_BLOCK_SIZE) // handle with mmap
+    // SMALLOCX_HUGEPAGE only maps small requests when MAP_HUGETLB is there to use, else they stay in the heap
+    bool is_huge = (needed_size > MAX_BLOCK_SIZE || (flags & SMALLOCX_HUGEPAGE)) && _use_hugepage(size, method, calloc_block_size, flags);
+    if (needed_size > MAX_BLOCK_SIZE || is_huge) // handle with mmap
     {
-        if (size >= (1 << 22) && method == Method::as_smalloc ) // 4MB
-        {
-            size_t hugepage_size = getHugePageSize(); // gonna change hugepage size?
-            needed_size = _align_size(needed_size, hugepage_size); // need to align size for the munmap later
+        int mmap_flags = MAP_PRIVATE | MAP_ANONYMOUS;
 
-            metadata_addr = mmap(NULL, needed_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (flags & SMALLOCX_POPULATE)
+            mmap_flags |= MAP_POPULATE;
 
-        }else if (calloc_block_size > (1 << 20)  && method == Method::as_scalloc) //2MB
+        if (is_huge)
         {
-            size_t hugepage_size = getHugePageSize(); 
-            needed_size = _align_size(needed_size, hugepage_size); // need to align size for the munmap later
-            
-            metadata_addr = mmap(NULL, needed_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
-
-        }else //regular
-            metadata_addr = mmap(NULL, needed_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            needed_size = _align_size(needed_size, _hugepage_size()); // need to align size for the munmap later
+            mmap_flags |= MAP_HUGETLB;
+        }
 
+        metadata_addr = mmap(NULL, needed_size, PROT_READ | PROT_WRITE, mmap_flags, -1, 0);
+        ++manager.num_mmap_calls;
         if (metadata_addr == MAP_FAILED)
             return NULL;
 
         metadata = (MallocMetadata*)metadata_addr;
         MallocMetadata::metadata_init_block(metadata, needed_size);
         metadata->is_free = false;
+        metadata->is_mmap = true;
+        metadata->is_huge = is_huge;
         metadata->method = method;
         manager.add_new_block(metadata);
+        _latency_path(is_huge ? path_hugetlb_mmap : path_mmap);
+        manager.set_requested_size(metadata, size);
+        if (profiler.sample_bytes != 0)
+            profiler.on_alloc(metadata, size);
 
-        data_addr = (char*)metadata_addr + sizeof(MallocMetadata);
-        return data_addr;
+        data_addr = (char*)metadata_addr + HEADER_SIZE;
+        return data_addr; // fresh mappings are already zeroed
     }
 
     metadata = manager.find_free_block(needed_size);
+    if (metadata == NULL && manager.grow())
+        metadata = manager.find_free_block(needed_size);
     if (metadata == NULL)
         return NULL;
     
-
+    size_t dirty_size = manager.dirty_size(metadata); // purged pages come back zeroed
     manager.mark_alloc_bin_block(metadata);
     metadata->method = method;
+    manager.set_requested_size(metadata, size);
+    if (profiler.sample_bytes != 0)
+        profiler.on_alloc(metadata, size);
     
-    data_addr = (char*)metadata + sizeof(MallocMetadata);
-    return data_addr;
-}
+    data_addr = (char*)metadata + HEADER_SIZE;
 
-void* scalloc(size_t num, size_t size)
-{
-    void* data_addr = _smalloc(size*num, Method::as_scalloc, size);
-    if (data_addr == NULL)
-        return NULL;
-    
-    std::memset(data_addr, 0, size*num);
+    if (flags & SMALLOCX_ZERO)
+        std::memset(data_addr, 0, dirty_size);
+    if (flags & SMALLOCX_POPULATE)
+        _prefault(data_addr, metadata->data_size());
     return data_addr;
 }
 
-void* smalloc(size_t size)
+// builds the alias header for an over aligned pointer inside the block at data_addr
+void* _align_data(void* data_addr, size_t alignment)
 {
-    return _smalloc(size, Method::as_smalloc);
+    MallocMetadata* metadata = _get_metadata(data_addr);
+    uintptr_t aligned_addr = _align_size((uintptr_t)data_addr + HEADER_SIZE, alignment);
+    MallocMetadata* alias = (MallocMetadata*)(aligned_addr - HEADER_SIZE);
+
+    alias->block_size = 0;
+    alias->is_free = false;
+    alias->method = metadata->method;
+    alias->block = metadata;
+
+    return (void*)aligned_addr;
 }
 
-void sfree(void* p)
+void _sfree(void* p)
 {
     if (p == NULL)
         return;
 
-    void* metadata_addr = (char*)p - sizeof(MallocMetadata);
-    MallocMetadata* metadata = (MallocMetadata*)metadata_addr;
+    MallocMetadata* metadata = _get_metadata(p);
 
     if (metadata->is_free)
         return;
 
-    if (metadata->block_size > MAX_BLOCK_SIZE) // handle with mmap
+    manager.set_requested_size(metadata, 0);
+    if (metadata->is_sampled)
+        profiler.on_free(metadata);
+    if (metadata->is_mmap)
     {
         manager.delete_block(metadata);
         munmap(metadata, metadata->block_size);
+        ++manager.num_munmap_calls;
+        _latency_path(path_munmap);
 
         return;
     }
     manager.mark_free_bin_block(metadata);
-    while ((metadata = manager.join_block_to_buddy(metadata)) != NULL);
+    size_t joins = 0;
+    MallocMetadata* joined;
+    while ((joined = manager.join_block_to_buddy(metadata)) != NULL){
+        metadata = joined;
+        ++joins;
+    }
+#ifdef SMALLOC_DECAY
+    if (metadata->block_size >= PURGE_MIN_BLOCK_SIZE)
+        metadata->freed_at = _decay_now_ms(); // left for the scavenger
+#else
+    manager.purge_excess(metadata);
+#endif
+    _latency_path(joins == 0 ? path_free : path_join);
+#ifdef SMALLOC_TRIM_THRESHOLD
+    if (manager.top_free_bytes() >= SMALLOC_TRIM_THRESHOLD)
+        manager.trim(0);
+#endif
     
 }
 
-void* srealloc(void* oldp, size_t size)
+void* _srealloc(void* oldp, size_t size)
 {
     if (size == 0 || size > MAX_SIZE)
         return NULL;
@@ -508,21 +1529,41 @@ void* srealloc(void* oldp, size_t size)
         return _smalloc(size);
 
     void* newp;
-    void* old_metadata_addr = (char*)oldp - sizeof(MallocMetadata);
-    size_t needed_size = size + sizeof(MallocMetadata);
-    MallocMetadata* old_metadata = (MallocMetadata*)old_metadata_addr;
+    size_t needed_size = size + HEADER_SIZE;
+    MallocMetadata* old_metadata = _get_metadata(oldp);
     MallocMetadata* new_metadata;
     size_t new_block_size;
 
+    if ((char*)oldp != (char*)old_metadata + HEADER_SIZE) // aligned block, only the tail of the data is ours
+    {
+        size_t usable_size = smalloc_usable_size(oldp);
+        if (size <= usable_size){
+            _latency_path(path_realloc_in_place);
+            return oldp;
+        }
+
+        newp = _smalloc(size, old_metadata->method);
+        if (newp == NULL)
+            return NULL;
+        std::memmove(newp, oldp, usable_size);
+        _sfree(oldp);
+        _latency_path(path_realloc_move);
+        return newp;
+    }
+
 
     if (needed_size > MAX_BLOCK_SIZE) // handle with mmap
     {
-        if(old_metadata->block_size == needed_size)
+        if(old_metadata->block_size == needed_size){
+            manager.set_requested_size(old_metadata, size);
+            _latency_path(path_realloc_in_place);
             return oldp;
+        }
             
         newp = _smalloc(size, old_metadata->method, size); //TODO if was originally calloced then the new size is the size of the block?
-        std::memmove(newp, oldp, old_metadata->data_size);
-        sfree(oldp);
+        std::memmove(newp, oldp, old_metadata->data_size());
+        _sfree(oldp);
+        _latency_path(path_realloc_move);
         return newp;
     }
 
@@ -538,8 +1579,10 @@ void* srealloc(void* oldp, size_t size)
         //     iter = manager.split_block(iter);
         // }
 
-        // newp = (char *)new_metadata + sizeof(MallocMetadata);
+        // newp = (char *)new_metadata + HEADER_SIZE;
         // return newp;
+        manager.set_requested_size(old_metadata, size);
+        _latency_path(path_realloc_in_place);
         return oldp;
 
     } else // needed_size < old_metadata->block_size
@@ -553,15 +1596,20 @@ void* srealloc(void* oldp, size_t size)
             }
 
             new_metadata = iter == NULL ? new_metadata : iter;
-            newp = (char *)new_metadata + sizeof(MallocMetadata);
-            std::memmove(newp, oldp, old_metadata->data_size);
+            if (new_metadata->is_sampled && new_metadata != old_metadata)
+                profiler.on_move(old_metadata, new_metadata);
+            newp = (char *)new_metadata + HEADER_SIZE;
+            std::memmove(newp, oldp, old_metadata->data_size());
+            manager.set_requested_size(new_metadata, size);
+            _latency_path(newp == oldp ? path_realloc_in_place : path_realloc_move);
             return newp;
         }
         else // gets new bin block
         {
             newp = _smalloc(size, old_metadata->method);
-            std::memmove(newp, oldp, old_metadata->data_size);
-            sfree(oldp);
+            std::memmove(newp, oldp, old_metadata->data_size());
+            _sfree(oldp);
+            _latency_path(path_realloc_move);
             return newp;
         }
     }
@@ -569,6 +1617,261 @@ void* srealloc(void* oldp, size_t size)
     return NULL;
 }
 
+void* _sexpand(void* p, size_t size)
+{
+    if (p == NULL || size == 0 || size > MAX_SIZE)
+        return NULL;
+
+    MallocMetadata* metadata = _get_metadata(p);
+    size_t needed_size = ((char*)p - (char*)metadata) + size;
+
+    if (metadata->is_free)
+        return NULL;
+    if (needed_size <= metadata->block_size){
+        _latency_path(path_realloc_in_place);
+        return p;
+    }
+
+    if (metadata->is_mmap) // grow the mapping without letting it move
+    {
+        ++manager.num_mremap_calls;
+        if (mremap(metadata, metadata->block_size, needed_size, 0) == MAP_FAILED)
+            return NULL;
+
+        manager.delete_block(metadata);
+        metadata->block_size = needed_size;
+        manager.add_new_block(metadata);
+        manager.set_requested_size(metadata, needed_size - HEADER_SIZE);
+        _latency_path(path_realloc_in_place);
+        return p;
+    }
+
+    if (needed_size > MAX_BLOCK_SIZE || manager.check_max_block_size_after_joins(metadata, true) < needed_size)
+        return NULL;
+
+    while (metadata->block_size < needed_size) // buddies all lie above, so metadata stays the block start
+        manager.join_block_to_buddy(metadata);
+
+    manager.set_requested_size(metadata, needed_size - HEADER_SIZE);
+    _latency_path(path_realloc_in_place);
+    return p;
+}
+
+size_t smalloc_usable_size(void* p)
+{
+    if (p == NULL)
+        return 0;
+
+    MallocMetadata* metadata = _get_metadata(p);
+    return (char*)metadata + metadata->block_size - (char*)p;
+}
+
+void* _smallocx(size_t size, int flags)
+{
+    size_t alignment = SMALLOCX_ALIGNMENT(flags);
+
+    if (alignment <= SMALLOC_MIN_ALIGNMENT)
+        return _smalloc(size, Method::as_smalloc, 0, flags);
+    if (size == 0 || size > MAX_SIZE)
+        return NULL;
+
+    // room for an alias header between the real data start and the aligned pointer
+    void* data_addr = _smalloc(size + alignment + HEADER_SIZE, Method::as_smalloc, 0, flags & ~SMALLOCX_ZERO);
+    if (data_addr == NULL)
+        return NULL;
+
+    data_addr = _align_data(data_addr, alignment);
+    manager.set_requested_size(_get_metadata(data_addr), size);
+    if (flags & SMALLOCX_ZERO)
+        std::memset(data_addr, 0, smalloc_usable_size(data_addr));
+    return data_addr;
+}
+
+void* _sreallocx(void* oldp, size_t size, int flags)
+{
+    if (oldp == NULL)
+        return _smallocx(size, flags);
+
+    size_t alignment = SMALLOCX_ALIGNMENT(flags);
+    size_t old_size = smalloc_usable_size(oldp);
+    bool old_aligned = (uintptr_t)oldp % alignment == 0;
+    void* newp;
+
+    if (flags & SMALLOCX_NO_MOVE)
+        newp = old_aligned ? _sexpand(oldp, size) : NULL; // growing in place can't fix the alignment
+    else if (alignment <= SMALLOC_MIN_ALIGNMENT)
+        newp = _srealloc(oldp, size);
+    else
+    {
+        // srealloc could move it without the alignment, so grow in place or move it here,
+        // oldp is only freed once the aligned copy exists
+        newp = old_aligned ? _sexpand(oldp, size) : NULL;
+        if (newp == NULL)
+        {
+            newp = _smallocx(size, flags & ~SMALLOCX_ZERO);
+            if (newp == NULL)
+                return NULL;
+
+            std::memmove(newp, oldp, old_size < size ? old_size : size);
+            _sfree(oldp);
+            _latency_path(path_realloc_move);
+        }
+    }
+
+    if (newp != NULL && (flags & SMALLOCX_ZERO) && old_size < smalloc_usable_size(newp))
+        std::memset((char*)newp + old_size, 0, smalloc_usable_size(newp) - old_size);
+    return newp;
+}
+
+void* smalloc(size_t size)
+{
+    AllocatorLock lock;
+    LatencyTimer timer;
+    void* p = _smalloc(size, Method::as_smalloc);
+    tracer.record(SMALLOC_TRACE_SMALLOC, p, NULL, size);
+    return p;
+}
+
+void* scalloc(size_t num, size_t size)
+{
+    AllocatorLock lock;
+    LatencyTimer timer;
+    void* p = _smalloc(size*num, Method::as_scalloc, size, SMALLOCX_ZERO);
+    tracer.record(SMALLOC_TRACE_SCALLOC, p, NULL, size*num);
+    return p;
+}
+
+void sfree(void* p)
+{
+    AllocatorLock lock;
+    LatencyTimer timer;
+    if (p != NULL)
+        tracer.record(SMALLOC_TRACE_SFREE, p, NULL, 0);
+    _sfree(p);
+}
+
+void* srealloc(void* oldp, size_t size)
+{
+    AllocatorLock lock;
+    LatencyTimer timer;
+    void* newp = _srealloc(oldp, size);
+    tracer.record(SMALLOC_TRACE_SREALLOC, newp, oldp, size);
+    return newp;
+}
+
+void* sexpand(void* p, size_t size)
+{
+    AllocatorLock lock;
+    LatencyTimer timer;
+    void* newp = _sexpand(p, size);
+    tracer.record(SMALLOC_TRACE_SEXPAND, newp, p, size); // failures too, the replay has to keep the block where it is
+    return newp;
+}
+
+void* smallocx(size_t size, int flags)
+{
+    AllocatorLock lock;
+    LatencyTimer timer;
+    void* p = _smallocx(size, flags);
+    tracer.record(SMALLOC_TRACE_SMALLOCX, p, NULL, size, flags);
+    return p;
+}
+
+void* sreallocx(void* oldp, size_t size, int flags)
+{
+    AllocatorLock lock;
+    LatencyTimer timer;
+    void* newp = _sreallocx(oldp, size, flags);
+    tracer.record(SMALLOC_TRACE_SREALLOCX, newp, oldp, size, flags);
+    return newp;
+}
+
+void* saligned_alloc(size_t alignment, size_t size)
+{
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0)
+        return NULL;
+
+    return smallocx(size, SMALLOCX_ALIGN(alignment));
+}
+
+int smalloc_stats(SmallocStats* stats)
+{
+    if (stats == NULL)
+        return -1;
+
+    AllocatorLock lock;
+    std::memset(stats, 0, sizeof(SmallocStats));
+    manager.count_orders(stats->free_blocks, stats->used_blocks, &stats->block_bytes, &stats->purged_bytes);
+
+    stats->mmap_blocks = manager.num_mmap_blocks;
+    stats->mmap_bytes = manager.num_mmap_bytes;
+    stats->hugetlb_blocks = manager.num_hugetlb_blocks;
+    stats->hugetlb_bytes = manager.num_hugetlb_bytes;
+    stats->block_bytes += manager.num_mmap_bytes + manager.num_hugetlb_bytes;
+    stats->requested_bytes = manager.requested_bytes;
+
+    stats->splits = manager.num_splits;
+    stats->joins = manager.num_joins;
+    stats->sbrk_calls = manager.num_sbrk_calls;
+    stats->mmap_calls = manager.num_mmap_calls;
+    stats->munmap_calls = manager.num_munmap_calls;
+    stats->mremap_calls = manager.num_mremap_calls;
+    stats->madvise_calls = manager.num_madvise_calls;
+    return 0;
+}
+
+void smalloc_prof_sample(size_t sample_bytes)
+{
+    profiler.set_sample_bytes(sample_bytes);
+}
+
+int smalloc_prof_dump(int fd)
+{
+    AllocatorLock lock;
+    return profiler.dump(fd);
+}
+
+int smalloc_latency_dump(int fd)
+{
+    return latency.dump(fd);
+}
+
+void smalloc_latency_reset()
+{
+    latency.reset();
+}
+
+int smalloc_dump_heap(int fd)
+{
+    AllocatorLock lock;
+    return manager.dump_heap(fd);
+}
+
+int smalloc_trim(size_t pad)
+{
+    AllocatorLock lock;
+    return manager.trim(pad) ? 1 : 0;
+}
+
+size_t smalloc_min_alignment()
+{
+    return SMALLOC_MIN_ALIGNMENT;
+}
+
+int smalloc_largest_free_order()
+{
+    AllocatorLock lock;
+    for (int order = MAX_ORDER; order >= 0; order--)
+        if (manager.level_manager[order].head != NULL)
+            return order;
+    return -1;
+}
+
+void smalloc_decay_ms(size_t decay_ms)
+{
+    scavenger.decay_ms = decay_ms;
+}
+
 size_t _num_free_blocks()
 {
     return manager.num_free_blocks;
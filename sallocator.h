@@ -0,0 +1,103 @@
+#ifndef SALLOCATOR_H
+#define SALLOCATOR_H
+
+// std::allocator and std::pmr::memory_resource adapters over the buddy heap (link with malloc_4.cpp)
+
+#include <cstddef>
+#include <new>
+
+#include "smalloc_ext.h"
+
+template <typename T>
+struct SAllocator
+{
+    typedef T value_type;
+
+    SAllocator() noexcept {}
+
+    template <typename U>
+    SAllocator(const SAllocator<U>&) noexcept {}
+
+    T* allocate(std::size_t n)
+    {
+        if (n > max_size())
+            throw std::bad_array_new_length();
+
+        void* p = alignof(T) <= smalloc_min_alignment() ? smalloc(n * sizeof(T)) : saligned_alloc(alignof(T), n * sizeof(T));
+        if (p == NULL)
+            throw std::bad_alloc();
+        return static_cast<T*>(p);
+    }
+
+    void deallocate(T* p, std::size_t) noexcept
+    {
+        sfree(p);
+    }
+
+    // grows the block at p to new_n elements in place, false if it would have to move
+    bool expand(T* p, std::size_t new_n) noexcept
+    {
+        return new_n <= max_size() && sexpand(p, new_n * sizeof(T)) != NULL;
+    }
+
+    std::size_t max_size() const noexcept
+    {
+        return 100000000 / sizeof(T);
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const SAllocator<T>&, const SAllocator<U>&) noexcept
+{
+    return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const SAllocator<T>&, const SAllocator<U>&) noexcept
+{
+    return false;
+}
+
+#if __cplusplus >= 201703L && __has_include(<memory_resource>)
+#include <memory_resource>
+
+class SMemoryResource : public std::pmr::memory_resource
+{
+    public:
+        // grows the block at p to new_bytes in place, false if it would have to move
+        bool expand(void* p, std::size_t new_bytes) noexcept
+        {
+            return sexpand(p, new_bytes) != NULL;
+        }
+
+    private:
+        void* do_allocate(std::size_t bytes, std::size_t alignment) override
+        {
+            if (bytes == 0)
+                bytes = 1;
+            void* p = alignment <= smalloc_min_alignment() ? smalloc(bytes) : saligned_alloc(alignment, bytes);
+            if (p == NULL)
+                throw std::bad_alloc();
+            return p;
+        }
+
+        void do_deallocate(void* p, std::size_t, std::size_t) override
+        {
+            sfree(p);
+        }
+
+        // every instance draws from the same heap
+        bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+        {
+            return dynamic_cast<const SMemoryResource*>(&other) != NULL;
+        }
+};
+
+inline SMemoryResource* smalloc_resource() noexcept
+{
+    static SMemoryResource resource;
+    return &resource;
+}
+#endif
+
+#endif /* SALLOCATOR_H */
@@ -0,0 +1,150 @@
+#ifndef SMALLOC_EXT_H
+#define SMALLOC_EXT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// core api, implemented by every malloc_<n>.cpp
+void *smalloc(size_t size);
+void *scalloc(size_t num, size_t size);
+void sfree(void *p);
+void *srealloc(void *oldp, size_t size);
+
+// grows the block at p to size bytes without moving it, returns p or NULL if it would have to move
+// (malloc_3.cpp and malloc_4.cpp)
+void *sexpand(void *p, size_t size);
+
+// lowers the program break over the free memory at the top of the heap, keeping pad bytes of it.
+// returns 1 if memory was given back, 0 if not (malloc_2.cpp, malloc_3.cpp and malloc_4.cpp)
+int smalloc_trim(size_t pad);
+
+// order of the largest free buddy block (block size 128 << order), -1 if the heap has none
+// (malloc_3.cpp and malloc_4.cpp)
+int smalloc_largest_free_order(void);
+
+// bump allocator marks (malloc_1.cpp): srelease frees everything smalloc returned since smark
+void *smark(void);
+void srelease(void *mark);
+
+// extensions implemented by malloc_4.cpp
+
+// alignment every pointer returned by smalloc/scalloc/srealloc is guaranteed to have (malloc_3.cpp too).
+// malloc_3.cpp/malloc_4.cpp built with -DSMALLOC_MIN_ALIGNMENT=64 hands out cache line aligned pointers.
+// the macro is only what this translation unit was built with, smalloc_min_alignment() is what the allocator was
+#ifndef SMALLOC_MIN_ALIGNMENT
+#define SMALLOC_MIN_ALIGNMENT 16
+#endif
+
+size_t smalloc_min_alignment(void);
+
+// bytes usable at p, never less than what was requested
+size_t smalloc_usable_size(void *p);
+
+// alignment must be a power of two; the result is released with sfree
+void *saligned_alloc(size_t alignment, size_t size);
+
+// smallocx/sreallocx flags, or'ed together
+#define SMALLOCX_ZERO 0x1        // zeroed memory (sreallocx zeroes the grown part)
+#define SMALLOCX_HUGEPAGE 0x2    // always use a MAP_HUGETLB mapping, whatever the size
+#define SMALLOCX_NO_HUGEPAGE 0x4 // never use MAP_HUGETLB
+#define SMALLOCX_POPULATE 0x8    // prefault the memory (MAP_POPULATE for mappings)
+#define SMALLOCX_NO_MOVE 0x10    // sreallocx only: fail instead of moving the block
+#define SMALLOCX_LG_ALIGN(lg) ((int)(lg) << 8)
+#define SMALLOCX_ALIGN(alignment) SMALLOCX_LG_ALIGN(__builtin_ctzl(alignment)) // alignment must be a power of two
+#define SMALLOCX_ALIGNMENT(flags) ((size_t)1 << (((flags) >> 8) & 0x3f))
+
+void *smallocx(size_t size, int flags);
+void *sreallocx(void *oldp, size_t size, int flags);
+
+#define SMALLOC_STATS_ORDERS 11
+
+struct SmallocStats
+{
+    // buddy heap, by order (block size 128 << order)
+    size_t free_blocks[SMALLOC_STATS_ORDERS];
+    size_t used_blocks[SMALLOC_STATS_ORDERS];
+
+    // mmap blocks, regular and MAP_HUGETLB
+    size_t mmap_blocks;
+    size_t mmap_bytes;
+    size_t hugetlb_blocks;
+    size_t hugetlb_bytes;
+
+    // live allocations: what callers asked for vs the blocks (metadata included) serving them
+    size_t requested_bytes;
+    size_t block_bytes;
+
+    // free buddy memory given back to the system with madvise, faulted back in on reuse
+    size_t purged_bytes;
+
+    // totals since startup
+    size_t splits;
+    size_t joins;
+    size_t sbrk_calls;
+    size_t mmap_calls;
+    size_t munmap_calls;
+    size_t mremap_calls;
+    size_t madvise_calls;
+};
+
+// fills stats with a snapshot of the allocator, returns 0 on success
+int smalloc_stats(struct SmallocStats *stats);
+
+// heap profiler: records the backtrace of one allocation every sample_bytes allocated bytes on average,
+// 0 turns it off. SMALLOC_PROF_SAMPLE=<bytes> turns it on at startup, SMALLOC_PROF_FILE=<path> dumps there at exit
+void smalloc_prof_sample(size_t sample_bytes);
+
+// writes the live sampled allocations to fd in pprof's legacy heap profile format, returns 0 on success
+int smalloc_prof_dump(int fd);
+
+// latency histograms of every path through the allocator (level hit, split, mmap, join, munmap, realloc...),
+// only kept when malloc_4.cpp is built with -DSMALLOC_LATENCY. writes a table of percentiles to fd, -1 if off
+int smalloc_latency_dump(int fd);
+void smalloc_latency_reset(void);
+
+// smalloc_dump_heap writes a SmallocHeapHeader, then for each superblock a uint32_t block count followed by one
+// byte per block in address order: the block's order, or'ed with SMALLOC_HEAP_USED if it is allocated
+#define SMALLOC_HEAP_MAGIC "SMHEAP01"
+#define SMALLOC_HEAP_USED 0x80
+
+struct SmallocHeapHeader
+{
+    char magic[8];
+    uint64_t heap_base;
+    uint32_t superblocks;
+    uint32_t superblock_size;
+    uint32_t min_block_size;
+    uint32_t pad;
+};
+
+// how long freed buddy memory stays resident before the background scavenger purges it, only used when
+// malloc_4.cpp is built with -DSMALLOC_DECAY (SMALLOC_DECAY_MS=<ms> sets it at startup)
+void smalloc_decay_ms(size_t decay_ms);
+
+// writes the occupancy map of the buddy heap to fd (bench/heapviz renders it), returns 0 on success
+int smalloc_dump_heap(int fd);
+
+// SMALLOC_TRACE_FILE=<path> records every call to path: a SmallocTraceHeader, then SmallocTraceRecords
+#define SMALLOC_TRACE_MAGIC "SMTRACE1"
+
+enum SmallocTraceOp {SMALLOC_TRACE_SMALLOC, SMALLOC_TRACE_SCALLOC, SMALLOC_TRACE_SREALLOC, SMALLOC_TRACE_SFREE,
+    SMALLOC_TRACE_SMALLOCX, SMALLOC_TRACE_SREALLOCX, SMALLOC_TRACE_SEXPAND};
+
+struct SmallocTraceHeader
+{
+    char magic[8];
+    uint64_t record_size;
+};
+
+struct SmallocTraceRecord
+{
+    uint64_t timestamp; // ns since the trace started
+    uint64_t ptr;       // returned (or freed) pointer, identifies the block
+    uint64_t old_ptr;   // srealloc, sreallocx and sexpand only
+    uint32_t size;      // requested bytes, num * size for scalloc
+    uint8_t op;         // SmallocTraceOp
+    uint8_t pad;
+    uint16_t flags;     // smallocx/sreallocx flags
+};
+
+#endif /* SMALLOC_EXT_H */
@@ -1,4 +1,5 @@
 #include "my_stdlib.h"
+#include "smalloc_ext.h"
 #include <catch2/catch_test_macros.hpp>
 
 #include <unistd.h>
@@ -51,3 +52,40 @@ TEST_CASE("Max size", "[malloc1]")
     after = sbrk(0);
     REQUIRE(MAX_ALLOCATION_SIZE == (size_t)after - (size_t)base);
 }
+
+TEST_CASE("smark srelease", "[malloc1]")
+{
+    void *base = sbrk(0);
+    void *mark = smark();
+    REQUIRE(mark == base);
+    REQUIRE(smalloc(100) != nullptr);
+    REQUIRE(smalloc(1000) != nullptr);
+
+    srelease(mark);
+    REQUIRE(sbrk(0) == base);
+    char *a = (char *)smalloc(10);
+    REQUIRE(a == base);
+}
+
+TEST_CASE("srelease stale mark", "[malloc1]")
+{
+    void *base = sbrk(0);
+    REQUIRE(smalloc(100) != nullptr);
+    void *mark = smark();
+    REQUIRE(smalloc(100) != nullptr);
+
+    // the break moved behind our back, the marks are stale
+    REQUIRE(sbrk(64) != (void *)(-1));
+    void *brk = sbrk(0);
+    srelease(mark);
+    srelease(NULL);
+    REQUIRE(sbrk(0) == brk);
+
+    // marks taken since are good again, NULL only goes back to where the new blocks start
+    char *a = (char *)smalloc(100);
+    REQUIRE(a == brk);
+    REQUIRE(smalloc(100) != nullptr);
+    srelease(NULL);
+    REQUIRE(sbrk(0) == brk);
+    REQUIRE(sbrk(0) > base);
+}
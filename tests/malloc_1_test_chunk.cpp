@@ -0,0 +1,79 @@
+#include "my_stdlib.h"
+#include "smalloc_ext.h"
+#include <catch2/catch_test_macros.hpp>
+
+#include <cstdint>
+#include <unistd.h>
+
+// malloc_1 built with -DMALLOC1_CHUNK_SIZE=65536
+
+#define CHUNK_SIZE (64 * 1024)
+#define MAX_ALLOCATION_SIZE (1e8)
+
+TEST_CASE("bump allocation", "[malloc1chunk]")
+{
+    char *base = (char *)sbrk(0);
+    char *a = (char *)smalloc(1);
+    REQUIRE(a != nullptr);
+    REQUIRE((uintptr_t)a % 16 == 0);
+    REQUIRE(a - base < 16);
+    char *end = (char *)sbrk(0);
+    REQUIRE(end == base + CHUNK_SIZE);
+
+    // from the cursor, no syscall
+    char *b = (char *)smalloc(17);
+    REQUIRE(b == a + 16);
+    char *c = (char *)smalloc(10);
+    REQUIRE(c == b + 32);
+    REQUIRE(sbrk(0) == end);
+
+    // runs on into the next chunk
+    char *d = (char *)smalloc(CHUNK_SIZE);
+    REQUIRE(d == c + 16);
+    REQUIRE(sbrk(0) == end + CHUNK_SIZE);
+    d[CHUNK_SIZE - 1] = 'd';
+}
+
+TEST_CASE("0 and max size", "[malloc1chunk]")
+{
+    REQUIRE(smalloc(0) == nullptr);
+    REQUIRE(smalloc(MAX_ALLOCATION_SIZE + 1) == nullptr);
+    char *a = (char *)smalloc(MAX_ALLOCATION_SIZE);
+    REQUIRE(a != nullptr);
+    a[(size_t)MAX_ALLOCATION_SIZE - 1] = 'a';
+}
+
+TEST_CASE("chunk smark srelease", "[malloc1chunk]")
+{
+    REQUIRE(smark() == nullptr);
+    char *a = (char *)smalloc(100);
+    REQUIRE(a != nullptr);
+    void *mark = smark();
+    char *b = (char *)smalloc(200);
+    REQUIRE(smalloc(300) != nullptr);
+
+    srelease(mark);
+    REQUIRE(smalloc(200) == b);
+
+    // the chunks stay, everything is released
+    void *end = sbrk(0);
+    srelease(nullptr);
+    REQUIRE(smalloc(100) == a);
+    REQUIRE(sbrk(0) == end);
+}
+
+TEST_CASE("break moved behind our back", "[malloc1chunk]")
+{
+    char *a = (char *)smalloc(100);
+    REQUIRE(a != nullptr);
+    void *mark = smark();
+    char *end = (char *)sbrk(0);
+    sbrk(100);
+
+    // a new run of chunks after the foreign memory, older marks are ignored
+    char *b = (char *)smalloc(CHUNK_SIZE);
+    REQUIRE(b >= end + 100);
+    REQUIRE((uintptr_t)b % 16 == 0);
+    srelease(mark);
+    REQUIRE(smalloc(16) == b + CHUNK_SIZE);
+}
@@ -1,4 +1,5 @@
 #include "my_stdlib.h"
+#include "smalloc_ext.h"
 #include <catch2/catch_test_macros.hpp>
 
 #include <unistd.h>
@@ -709,3 +710,75 @@ TEST_CASE("srealloc Max size", "[malloc2]")
     verify_blocks(1, MAX_ALLOCATION_SIZE, 1, MAX_ALLOCATION_SIZE);
     verify_size(base);
 }
+
+TEST_CASE("Reuse first fit across size classes", "[malloc2]")
+{
+    verify_blocks(0, 0, 0, 0);
+
+    void *base = sbrk(0);
+    char *a = (char *)smalloc(1000);
+    REQUIRE(a != nullptr);
+    char *b = (char *)smalloc(40);
+    REQUIRE(b != nullptr);
+    char *c = (char *)smalloc(60);
+    REQUIRE(c != nullptr);
+    char *d = (char *)smalloc(100);
+    REQUIRE(d != nullptr);
+    verify_blocks(4, 1200, 0, 0);
+
+    sfree(d);
+    sfree(c);
+    sfree(b);
+    sfree(a);
+    verify_blocks(4, 1200, 4, 1200);
+
+    // the lowest address that fits, whatever its size
+    char *e = (char *)smalloc(50);
+    REQUIRE(e == a);
+    char *f = (char *)smalloc(50);
+    REQUIRE(f == c);
+    char *g = (char *)smalloc(50);
+    REQUIRE(g == d);
+    char *h = (char *)smalloc(30);
+    REQUIRE(h == b);
+    verify_blocks(4, 1200, 0, 0);
+    verify_size(base);
+
+    sfree(e);
+    sfree(f);
+    sfree(g);
+    sfree(h);
+    verify_blocks(4, 1200, 4, 1200);
+    verify_size(base);
+}
+
+TEST_CASE("smalloc_trim", "[malloc2]")
+{
+    verify_blocks(0, 0, 0, 0);
+    void *base = sbrk(0);
+    char *a = (char *)smalloc(1000);
+    REQUIRE(a != nullptr);
+    char *b = (char *)smalloc(5000);
+    REQUIRE(b != nullptr);
+    REQUIRE(smalloc_trim(0) == 0); // the last block is in use
+
+    sfree(b);
+    REQUIRE(smalloc_trim(1000) == 1);
+    verify_blocks(2, 2000, 1, 1000);
+    verify_size(base);
+    REQUIRE(smalloc_trim(1000) == 0);
+
+    REQUIRE(smalloc_trim(0) == 1);
+    verify_blocks(1, 1000, 0, 0);
+    verify_size(base);
+
+    sfree(a);
+    REQUIRE(smalloc_trim(0) == 1);
+    verify_blocks(0, 0, 0, 0);
+    REQUIRE(sbrk(0) == base);
+
+    char *c = (char *)smalloc(10);
+    REQUIRE(c == (char *)base + _size_meta_data());
+    verify_blocks(1, 10, 0, 0);
+    sfree(c);
+}
@@ -0,0 +1,411 @@
+#include "my_stdlib.h"
+#include <catch2/catch_test_macros.hpp>
+
+#include <unistd.h>
+
+// malloc_2 built with its optional behaviour turned on (see the top of malloc_2.cpp), each target with some of it
+
+#define verify_blocks(allocated_blocks, allocated_bytes, free_blocks, free_bytes)                                      \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        REQUIRE(_num_allocated_blocks() == allocated_blocks);                                                          \
+        REQUIRE(_num_allocated_bytes() == allocated_bytes);                                                            \
+        REQUIRE(_num_free_blocks() == free_blocks);                                                                    \
+        REQUIRE(_num_free_bytes() == free_bytes);                                                                      \
+        REQUIRE(_num_meta_data_bytes() == _size_meta_data() * allocated_blocks);                                       \
+    } while (0)
+
+#define verify_size(base)                                                                                              \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        void *after = sbrk(0);                                                                                         \
+        REQUIRE(_num_allocated_bytes() + _size_meta_data() * _num_allocated_blocks() == (size_t)after - (size_t)base); \
+    } while (0)
+
+#define MIN_SPLIT_DATA_SIZE 128
+
+TEST_CASE("split on reuse", "[malloc2ext]")
+{
+    verify_blocks(0, 0, 0, 0);
+
+    void *base = sbrk(0);
+    char *a = (char *)smalloc(1000);
+    REQUIRE(a != nullptr);
+    char *b = (char *)smalloc(10); // keeps a from being the last block
+    REQUIRE(b != nullptr);
+    sfree(a);
+    verify_blocks(2, 1010, 1, 1000);
+
+    char *c = (char *)smalloc(16);
+    REQUIRE(c == a);
+    size_t rest = 1000 - 16 - _size_meta_data();
+    verify_blocks(3, 1010 - _size_meta_data(), 1, rest);
+    verify_size(base);
+
+    // the rest is a block of its own
+    char *d = (char *)smalloc(rest);
+    REQUIRE(d == c + 16 + _size_meta_data());
+    verify_blocks(3, 1010 - _size_meta_data(), 0, 0);
+    verify_size(base);
+
+    sfree(b);
+    sfree(c);
+    sfree(d);
+}
+
+TEST_CASE("split needs room for a block", "[malloc2ext]")
+{
+    verify_blocks(0, 0, 0, 0);
+
+    void *base = sbrk(0);
+    size_t size = 100 + _size_meta_data() + MIN_SPLIT_DATA_SIZE - 1;
+    char *a = (char *)smalloc(size);
+    REQUIRE(a != nullptr);
+    char *b = (char *)smalloc(10);
+    REQUIRE(b != nullptr);
+    sfree(a);
+
+    char *c = (char *)smalloc(100);
+    REQUIRE(c == a);
+    verify_blocks(2, size + 10, 0, 0);
+    verify_size(base);
+
+    sfree(c);
+    c = (char *)smalloc(99);
+    REQUIRE(c == a);
+    verify_blocks(3, size + 10 - _size_meta_data(), 1, MIN_SPLIT_DATA_SIZE);
+    verify_size(base);
+
+    sfree(b);
+    sfree(c);
+}
+
+TEST_CASE("split on srealloc reuse", "[malloc2ext]")
+{
+    verify_blocks(0, 0, 0, 0);
+
+    void *base = sbrk(0);
+    char *a = (char *)smalloc(1000);
+    REQUIRE(a != nullptr);
+    char *b = (char *)smalloc(10); // keeps the rest of a and c apart
+    REQUIRE(b != nullptr);
+    char *c = (char *)smalloc(10);
+    REQUIRE(c != nullptr);
+    char *last = (char *)smalloc(10); // c isn't the last block, so it can't grow in place
+    REQUIRE(last != nullptr);
+    sfree(a);
+
+    char *d = (char *)srealloc(c, 20);
+    REQUIRE(d == a);
+    verify_blocks(5, 1030 - _size_meta_data(), 2, 10 + 1000 - 20 - _size_meta_data());
+    verify_size(base);
+
+    sfree(b);
+    sfree(d);
+    sfree(last);
+}
+
+TEST_CASE("coalesce", "[malloc2ext]")
+{
+    verify_blocks(0, 0, 0, 0);
+
+    void *base = sbrk(0);
+    char *a = (char *)smalloc(10);
+    REQUIRE(a != nullptr);
+    char *b = (char *)smalloc(10);
+    REQUIRE(b != nullptr);
+    char *c = (char *)smalloc(10);
+    REQUIRE(c != nullptr);
+    char *d = (char *)smalloc(10);
+    REQUIRE(d != nullptr);
+    verify_blocks(4, 40, 0, 0);
+
+    sfree(a);
+    sfree(c);
+    verify_blocks(4, 40, 2, 20);
+    verify_size(base);
+
+    // merges with both neighbors
+    sfree(b);
+    verify_blocks(2, 40 + 2 * _size_meta_data(), 1, 30 + 2 * _size_meta_data());
+    verify_size(base);
+
+    // a large request fits in the merged block instead of growing the heap
+    char *e = (char *)smalloc(30 + 2 * _size_meta_data());
+    REQUIRE(e == a);
+    verify_size(base);
+
+    sfree(d);
+    sfree(e);
+    verify_blocks(1, 40 + 3 * _size_meta_data(), 1, 40 + 3 * _size_meta_data());
+    verify_size(base);
+}
+
+TEST_CASE("coalesce keeps the heap bounded", "[malloc2ext]")
+{
+    verify_blocks(0, 0, 0, 0);
+
+    void *base = sbrk(0);
+    void *blocks[100];
+    for (int i = 0; i < 100; i++)
+    {
+        blocks[i] = smalloc(100);
+        REQUIRE(blocks[i] != nullptr);
+    }
+    void *after = sbrk(0);
+
+    for (int round = 0; round < 10; round++)
+    {
+        for (int i = 0; i < 100; i++)
+        {
+            sfree(blocks[i]);
+        }
+        verify_blocks(1, 100 * 100 + 99 * _size_meta_data(), 1, 100 * 100 + 99 * _size_meta_data());
+
+        void *all = smalloc(100 * 100);
+        REQUIRE(all == (char *)base + _size_meta_data());
+        sfree(all);
+
+        for (int i = 0; i < 100; i++)
+        {
+            blocks[i] = smalloc(90 - round); // split off the merged block
+            REQUIRE(blocks[i] != nullptr);
+        }
+    }
+    REQUIRE(sbrk(0) == after);
+
+    for (int i = 0; i < 100; i++)
+    {
+        sfree(blocks[i]);
+    }
+}
+
+#if !defined(MALLOC2_MMAP)
+TEST_CASE("coalesce past MAX_SIZE", "[malloc2ext]")
+{
+    verify_blocks(0, 0, 0, 0);
+
+    char *a = (char *)smalloc(100000000);
+    char *b = (char *)smalloc(100000000);
+    char *guard = (char *)smalloc(10);
+    REQUIRE(guard != nullptr);
+    sfree(a);
+    sfree(b);
+    verify_blocks(2, 200000000 + _size_meta_data() + 10, 1, 200000000 + _size_meta_data());
+
+    // the merged block is bigger than any request but still found
+    void *brk = sbrk(0);
+    char *c = (char *)smalloc(50000000);
+    REQUIRE(c == a);
+    REQUIRE(sbrk(0) == brk);
+
+    sfree(c);
+    sfree(guard);
+}
+#endif
+
+#ifdef MALLOC2_WILDERNESS
+TEST_CASE("wilderness smalloc", "[malloc2ext]")
+{
+    verify_blocks(0, 0, 0, 0);
+
+    void *base = sbrk(0);
+    char *a = (char *)smalloc(100);
+    REQUIRE(a != nullptr);
+    sfree(a);
+
+    // the free last block grows by what is missing
+    char *b = (char *)smalloc(300);
+    REQUIRE(b == a);
+    REQUIRE((char *)sbrk(0) == (char *)base + _size_meta_data() + 300);
+    verify_blocks(1, 300, 0, 0);
+    verify_size(base);
+
+    sfree(b);
+    verify_blocks(1, 300, 1, 300);
+}
+
+TEST_CASE("wilderness srealloc", "[malloc2ext]")
+{
+    verify_blocks(0, 0, 0, 0);
+
+    void *base = sbrk(0);
+    int *a = (int *)smalloc(10 * sizeof(int));
+    REQUIRE(a != nullptr);
+    for (int i = 0; i < 10; i++)
+    {
+        a[i] = i;
+    }
+
+    // the last block grows in place
+    int *b = (int *)srealloc(a, 100 * sizeof(int));
+    REQUIRE(b == a);
+    for (int i = 0; i < 10; i++)
+    {
+        REQUIRE(b[i] == i);
+    }
+    REQUIRE((char *)sbrk(0) == (char *)base + _size_meta_data() + 100 * sizeof(int));
+    verify_blocks(1, 100 * sizeof(int), 0, 0);
+    verify_size(base);
+
+    // other blocks still move
+    char *c = (char *)smalloc(10);
+    REQUIRE(c != nullptr);
+    int *d = (int *)srealloc(b, 200 * sizeof(int));
+    REQUIRE(d != b);
+    verify_blocks(3, 300 * sizeof(int) + 10, 1, 100 * sizeof(int));
+    verify_size(base);
+
+    sfree(c);
+    sfree(d);
+}
+
+#endif
+
+#ifdef MALLOC2_BEST_FIT
+TEST_CASE("best fit", "[malloc2ext]")
+{
+    verify_blocks(0, 0, 0, 0);
+
+    void *base = sbrk(0);
+    char *a = (char *)smalloc(1000);
+    char *guard_a = (char *)smalloc(10);
+    char *b = (char *)smalloc(100);
+    char *guard_b = (char *)smalloc(10);
+    char *c = (char *)smalloc(500);
+    char *guard_c = (char *)smalloc(10);
+    char *d = (char *)smalloc(100);
+    char *guard_d = (char *)smalloc(10);
+    REQUIRE(guard_d != nullptr);
+    sfree(a);
+    sfree(b);
+    sfree(c);
+    sfree(d);
+    verify_blocks(8, 1740, 4, 1700);
+
+    // the smallest block that fits, the lowest address among equal sizes
+    char *e = (char *)smalloc(90);
+    REQUIRE(e == b);
+    char *f = (char *)smalloc(90);
+    REQUIRE(f == d);
+    char *g = (char *)smalloc(400);
+    REQUIRE(g == c);
+    char *h = (char *)smalloc(400);
+    REQUIRE(h == a);
+    verify_size(base);
+
+    sfree(e);
+    sfree(f);
+    sfree(g);
+    sfree(h);
+    sfree(guard_a);
+    sfree(guard_b);
+    sfree(guard_c);
+    sfree(guard_d);
+}
+
+#endif
+
+TEST_CASE("random churn", "[malloc2ext]")
+{
+    verify_blocks(0, 0, 0, 0);
+
+    unsigned int seed = 1;
+    char *blocks[200] = {nullptr};
+    size_t sizes[200] = {0};
+    for (int i = 0; i < 20000; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        int k = (seed >> 8) % 200;
+        if (blocks[k] != nullptr)
+        {
+            for (size_t j = 0; j < sizes[k]; j++)
+            {
+                REQUIRE(blocks[k][j] == (char)k);
+            }
+            sfree(blocks[k]);
+            blocks[k] = nullptr;
+            continue;
+        }
+
+        sizes[k] = 1 + (seed >> 12) % 3000;
+        blocks[k] = (char *)smalloc(sizes[k]);
+        REQUIRE(blocks[k] != nullptr);
+        for (size_t j = 0; j < sizes[k]; j++)
+        {
+            blocks[k][j] = (char)k;
+        }
+    }
+
+    for (int k = 0; k < 200; k++)
+    {
+        sfree(blocks[k]);
+    }
+    REQUIRE(_num_free_blocks() == _num_allocated_blocks());
+}
+
+#ifdef MALLOC2_MMAP
+#define MMAP_THRESHOLD (128 * 1024)
+
+TEST_CASE("mmap large requests", "[malloc2ext]")
+{
+    verify_blocks(0, 0, 0, 0);
+
+    void *base = sbrk(0);
+    char *a = (char *)smalloc(MMAP_THRESHOLD);
+    REQUIRE(a != nullptr);
+    REQUIRE(sbrk(0) == base);
+    verify_blocks(1, MMAP_THRESHOLD, 0, 0);
+    for (size_t i = 0; i < MMAP_THRESHOLD; i++)
+    {
+        a[i] = (char)i;
+    }
+
+    // into and out of a mapping
+    char *b = (char *)srealloc(a, 2 * MMAP_THRESHOLD);
+    REQUIRE(b != nullptr);
+    REQUIRE(sbrk(0) == base);
+    verify_blocks(1, 2 * MMAP_THRESHOLD, 0, 0);
+    for (size_t i = 0; i < MMAP_THRESHOLD; i++)
+    {
+        REQUIRE(b[i] == (char)i);
+    }
+    REQUIRE(srealloc(b, 100) == b); // shrinking keeps the mapping
+
+    sfree(b);
+    verify_blocks(0, 0, 0, 0);
+    REQUIRE(sbrk(0) == base);
+}
+
+TEST_CASE("mmap threshold adapts", "[malloc2ext]")
+{
+    verify_blocks(0, 0, 0, 0);
+
+    void *base = sbrk(0);
+    char *a = (char *)smalloc(200 * 1024);
+    REQUIRE(a != nullptr);
+    REQUIRE(sbrk(0) == base);
+    sfree(a);
+    verify_blocks(0, 0, 0, 0);
+
+    // freeing a mapping raised the threshold past its size
+    char *b = (char *)smalloc(200 * 1024);
+    REQUIRE(b != nullptr);
+    REQUIRE(sbrk(0) != base);
+    verify_blocks(1, 200 * 1024, 0, 0);
+    verify_size(base);
+
+    // but never past the cap
+    char *c = (char *)smalloc(64 * 1024 * 1024);
+    REQUIRE(c != nullptr);
+    sfree(c);
+    void *brk = sbrk(0);
+    char *d = (char *)smalloc(64 * 1024 * 1024);
+    REQUIRE(d != nullptr);
+    REQUIRE(sbrk(0) == brk);
+    verify_blocks(2, 200 * 1024 + 64 * 1024 * 1024, 0, 0);
+
+    sfree(b);
+    sfree(d);
+}
+#endif
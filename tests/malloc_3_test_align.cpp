@@ -0,0 +1,74 @@
+#include "my_stdlib.h"
+#include "smalloc_ext.h"
+#include <catch2/catch_test_macros.hpp>
+
+#include <cstdint>
+#include <vector>
+
+#define MAX_ELEMENT_SIZE (128 * 1024)
+
+static bool aligned(void *p)
+{
+    return (uintptr_t)p % smalloc_min_alignment() == 0;
+}
+
+TEST_CASE("min alignment", "[malloc3]")
+{
+    REQUIRE(smalloc_min_alignment() == SMALLOC_MIN_ALIGNMENT); // the target builds both with the same value
+    REQUIRE(smalloc_min_alignment() >= 16);
+    REQUIRE(_size_meta_data() % smalloc_min_alignment() == 0);
+
+    std::vector<void *> blocks;
+    for (size_t size = 1; size <= 3 * MAX_ELEMENT_SIZE; size = size * 3 / 2 + 1) // buddy blocks of every order and mmaps
+    {
+        void *a = smalloc(size);
+        void *b = scalloc(1, size);
+        REQUIRE(a != nullptr);
+        REQUIRE(b != nullptr);
+        REQUIRE(aligned(a));
+        REQUIRE(aligned(b));
+        blocks.push_back(a);
+        blocks.push_back(b);
+    }
+
+    for (void *&p : blocks)
+    {
+        p = srealloc(p, 200);
+        REQUIRE(p != nullptr);
+        REQUIRE(aligned(p));
+    }
+    for (void *p : blocks)
+    {
+        sfree(p);
+    }
+    REQUIRE(_num_free_blocks() == _num_allocated_blocks());
+}
+
+TEST_CASE("min alignment costs no order for small sizes", "[malloc3]")
+{
+    // the padded header still leaves a cache line of data in the smallest block
+    char *a = (char *)smalloc(64);
+    char *b = (char *)smalloc(64);
+    REQUIRE(a != nullptr);
+    REQUIRE(b != nullptr);
+    REQUIRE(b - a == 128);
+    sfree(a);
+    sfree(b);
+}
+
+#if !defined(SMALLOC_COMPACT_HEADER) && !defined(SMALLOC_DECAY)
+TEST_CASE("min alignment header size", "[malloc3]")
+{
+    // the header is 32 bytes, already 16 byte aligned, the 64 byte mode pads it to a cache line
+    REQUIRE(_size_meta_data() == (smalloc_min_alignment() > 32 ? smalloc_min_alignment() : 32));
+
+    size_t size = 128 - _size_meta_data(); // 96 by default
+    char *a = (char *)smalloc(size);
+    char *b = (char *)smalloc(size);
+    REQUIRE(a != nullptr);
+    REQUIRE(b != nullptr);
+    REQUIRE(b - a == 128);
+    sfree(a);
+    sfree(b);
+}
+#endif
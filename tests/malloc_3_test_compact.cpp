@@ -0,0 +1,74 @@
+#include "my_stdlib.h"
+#include <catch2/catch_test_macros.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// malloc_3/malloc_4 built with -DSMALLOC_COMPACT_HEADER
+
+#define MIN_BLOCK_SIZE 128
+
+TEST_CASE("compact header", "[malloc3compact]")
+{
+    REQUIRE(_size_meta_data() <= 16);
+
+    // a whole minimal block of data fits in one order 0 block
+    size_t size = MIN_BLOCK_SIZE - _size_meta_data();
+    char *a = (char *)smalloc(size);
+    char *b = (char *)smalloc(size);
+    REQUIRE(a != nullptr);
+    REQUIRE(b != nullptr);
+    REQUIRE(b - a == MIN_BLOCK_SIZE);
+    std::memset(a, 'a', size);
+    std::memset(b, 'b', size);
+
+    sfree(a);
+    REQUIRE(b[0] == 'b'); // the free links in a's payload stay out of b
+    char *c = (char *)smalloc(size);
+    REQUIRE(c == a);
+    sfree(b);
+    sfree(c);
+    REQUIRE(_num_free_blocks() == _num_allocated_blocks());
+}
+
+TEST_CASE("compact header churn", "[malloc3compact]")
+{
+    std::vector<unsigned char *> blocks;
+    std::vector<size_t> sizes;
+    uint32_t seed = 1;
+
+    for (int round = 0; round < 4; round++)
+    {
+        for (int i = 0; i < 200; i++)
+        {
+            seed = seed * 1103515245 + 12345;
+            size_t size = 1 + (seed >> 8) % 4000;
+            unsigned char *p = (unsigned char *)smalloc(size);
+            REQUIRE(p != nullptr);
+            std::memset(p, (unsigned char)blocks.size(), size);
+            blocks.push_back(p);
+            sizes.push_back(size);
+        }
+
+        // free every other block, the survivors must be untouched by the free lists
+        for (size_t i = round % 2; i < blocks.size(); i += 2)
+        {
+            sfree(blocks[i]);
+            blocks[i] = nullptr;
+        }
+        for (size_t i = 0; i < blocks.size(); i++)
+        {
+            for (size_t j = 0; blocks[i] != nullptr && j < sizes[i]; j++)
+            {
+                REQUIRE(blocks[i][j] == (unsigned char)i);
+            }
+        }
+    }
+
+    for (unsigned char *p : blocks)
+    {
+        sfree(p);
+    }
+    REQUIRE(_num_free_blocks() == _num_allocated_blocks());
+}
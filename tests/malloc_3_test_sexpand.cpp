@@ -0,0 +1,88 @@
+#include "my_stdlib.h"
+#include "smalloc_ext.h"
+#include <catch2/catch_test_macros.hpp>
+
+#include <cstring>
+
+#define MAX_ELEMENT_SIZE (128 * 1024)
+
+TEST_CASE("sexpand joins buddies above", "[malloc3]")
+{
+    char *a = (char *)smalloc(100);
+    REQUIRE(a != nullptr);
+    std::memset(a, 'a', 100);
+    size_t blocks = _num_allocated_blocks();
+
+    REQUIRE(sexpand(a, 50) == a);
+    REQUIRE(_num_allocated_blocks() == blocks);
+
+    REQUIRE(sexpand(a, 1000) == a);
+    REQUIRE(_num_allocated_blocks() == blocks - 3);
+    for (int i = 0; i < 100; i++)
+    {
+        REQUIRE(a[i] == 'a');
+    }
+    std::memset(a, 'b', 1000);
+
+    sfree(a);
+    REQUIRE(_num_free_blocks() == _num_allocated_blocks());
+}
+
+TEST_CASE("sexpand fails instead of moving", "[malloc3]")
+{
+    char *a = (char *)smalloc(100);
+    char *b = (char *)smalloc(100);
+    REQUIRE(a != nullptr);
+    REQUIRE(b != nullptr);
+    std::memset(b, 'b', 100);
+    size_t blocks = _num_allocated_blocks();
+    size_t free_bytes = _num_free_bytes();
+
+    // a is b's buddy and still in use
+    REQUIRE(sexpand(a, 300) == nullptr);
+
+    // a is free, but joining would move b down to a
+    sfree(a);
+    blocks = _num_allocated_blocks();
+    free_bytes = _num_free_bytes();
+    REQUIRE(sexpand(b, 300) == nullptr);
+    REQUIRE(_num_allocated_blocks() == blocks);
+    REQUIRE(_num_free_bytes() == free_bytes);
+    for (int i = 0; i < 100; i++)
+    {
+        REQUIRE(b[i] == 'b');
+    }
+
+    REQUIRE(sexpand(b, MAX_ELEMENT_SIZE) == nullptr);
+    REQUIRE(sexpand(nullptr, 100) == nullptr);
+    REQUIRE(sexpand(b, 0) == nullptr);
+
+    sfree(b);
+    REQUIRE(_num_free_blocks() == _num_allocated_blocks());
+}
+
+TEST_CASE("sexpand mmap", "[malloc3]")
+{
+    char *a = (char *)smalloc(MAX_ELEMENT_SIZE + 100);
+    REQUIRE(a != nullptr);
+    std::memset(a, 'a', MAX_ELEMENT_SIZE + 100);
+    size_t allocated_bytes = _num_allocated_bytes();
+
+    REQUIRE(sexpand(a, MAX_ELEMENT_SIZE) == a);
+    REQUIRE(_num_allocated_bytes() == allocated_bytes);
+
+    // the mapping can only grow when the address range above it is unused
+    if (sexpand(a, 4 * MAX_ELEMENT_SIZE) == a)
+    {
+        REQUIRE(_num_allocated_bytes() == allocated_bytes + 3 * MAX_ELEMENT_SIZE - 100);
+        std::memset(a, 'b', 4 * MAX_ELEMENT_SIZE);
+    }
+    else
+    {
+        REQUIRE(_num_allocated_bytes() == allocated_bytes);
+        REQUIRE(a[MAX_ELEMENT_SIZE + 99] == 'a');
+    }
+
+    sfree(a);
+    REQUIRE(_num_free_blocks() == _num_allocated_blocks());
+}
@@ -0,0 +1,73 @@
+#include "my_stdlib.h"
+#include "smalloc_ext.h"
+#include <catch2/catch_test_macros.hpp>
+
+#include <unistd.h>
+
+#define MAX_ELEMENT_SIZE (128 * 1024)
+
+TEST_CASE("smalloc_trim", "[malloc3]")
+{
+    char *a = (char *)smalloc(100); // splits the lowest superblock
+    REQUIRE(a != nullptr);
+    char *top = (char *)sbrk(0);
+    size_t blocks = _num_allocated_blocks();
+
+    REQUIRE(smalloc_trim(31 * MAX_ELEMENT_SIZE) == 0);
+    REQUIRE(smalloc_trim(10 * MAX_ELEMENT_SIZE + 1) == 1);
+    REQUIRE((char *)sbrk(0) == top - 20 * MAX_ELEMENT_SIZE);
+    REQUIRE(_num_allocated_blocks() == blocks - 20);
+    REQUIRE(smalloc_trim(0) == 1);
+    REQUIRE((char *)sbrk(0) == top - 31 * MAX_ELEMENT_SIZE);
+    REQUIRE(_num_allocated_blocks() == blocks - 31);
+    REQUIRE(_num_free_blocks() == _num_allocated_blocks() - 1);
+
+    // trimmed superblocks come back, but never more than there were
+    char *blocks_used[31];
+    for (int i = 0; i < 31; i++)
+    {
+        blocks_used[i] = (char *)smalloc(MAX_ELEMENT_SIZE - _size_meta_data());
+        REQUIRE(blocks_used[i] != nullptr);
+        blocks_used[i][0] = 'a';
+    }
+    REQUIRE((char *)sbrk(0) == top);
+    REQUIRE(_num_allocated_blocks() == blocks);
+    REQUIRE(smalloc(MAX_ELEMENT_SIZE - _size_meta_data()) == nullptr);
+
+    for (int i = 0; i < 31; i++)
+    {
+        sfree(blocks_used[i]);
+    }
+    sfree(a);
+    REQUIRE(smalloc_trim(0) == 1);
+    REQUIRE((char *)sbrk(0) == top - 32 * MAX_ELEMENT_SIZE);
+    REQUIRE(_num_allocated_blocks() == 0);
+    REQUIRE(_num_free_bytes() == 0);
+
+    a = (char *)smalloc(100);
+    REQUIRE(a != nullptr);
+    REQUIRE((char *)sbrk(0) == top - 31 * MAX_ELEMENT_SIZE);
+    sfree(a);
+}
+
+TEST_CASE("smalloc_largest_free_order", "[malloc3]")
+{
+    char *a = (char *)smalloc(100); // splits the lowest superblock down to order 0
+    REQUIRE(a != nullptr);
+    REQUIRE(smalloc_largest_free_order() == 10);
+
+    char *blocks[31];
+    for (int i = 0; i < 31; i++)
+    {
+        blocks[i] = (char *)smalloc(MAX_ELEMENT_SIZE - _size_meta_data());
+        REQUIRE(blocks[i] != nullptr);
+    }
+    REQUIRE(smalloc_largest_free_order() == 9); // a's buddies are all that is left
+
+    for (int i = 0; i < 31; i++)
+    {
+        sfree(blocks[i]);
+    }
+    sfree(a);
+    REQUIRE(smalloc_largest_free_order() == 10);
+}
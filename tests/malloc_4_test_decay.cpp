@@ -0,0 +1,92 @@
+#include "my_stdlib.h"
+#include "smalloc_ext.h"
+#include <catch2/catch_test_macros.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// malloc_4 built with -DSMALLOC_DECAY
+
+#define MMAP_THRESHOLD (128 * 1024)
+
+static size_t purged_bytes()
+{
+    SmallocStats stats;
+    REQUIRE(smalloc_stats(&stats) == 0);
+    return stats.purged_bytes;
+}
+
+TEST_CASE("decay purges in the background", "[malloc4decay]")
+{
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t size = MMAP_THRESHOLD - _size_meta_data(); // a whole top order block
+    smalloc_decay_ms(100);
+
+    char *a = (char *)smalloc(size);
+    REQUIRE(a != nullptr);
+    std::memset(a, 'a', size);
+    sfree(a);
+    REQUIRE(purged_bytes() == 0); // sfree leaves it resident
+
+    for (int i = 0; i < 100 && purged_bytes() == 0; i++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    REQUIRE(purged_bytes() == MMAP_THRESHOLD - page_size);
+
+    // reused before the decay time, nothing is purged
+    smalloc_decay_ms(60 * 1000);
+    char *b = (char *)scalloc(1, size);
+    REQUIRE(b == a);
+    REQUIRE(b[size - 1] == 0);
+    std::memset(b, 'b', size);
+    sfree(b);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    REQUIRE(purged_bytes() == 0);
+}
+
+TEST_CASE("decay allocator lock", "[malloc4decay]")
+{
+    smalloc_decay_ms(1);
+
+    std::atomic<int> corrupted(0); // REQUIRE isn't thread safe
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++)
+    {
+        threads.emplace_back([t, &corrupted]() {
+            unsigned int seed = t + 1;
+            char *blocks[64] = {nullptr};
+            for (int i = 0; i < 20000; i++)
+            {
+                seed = seed * 1103515245 + 12345;
+                int k = (seed >> 8) % 64;
+                if (blocks[k] != nullptr)
+                {
+                    if (blocks[k][0] != (char)k)
+                        ++corrupted;
+                    sfree(blocks[k]);
+                    blocks[k] = nullptr;
+                    continue;
+                }
+                size_t size = 1 + (seed >> 12) % (MMAP_THRESHOLD / 2);
+                blocks[k] = (char *)smalloc(size);
+                if (blocks[k] != nullptr)
+                    std::memset(blocks[k], k, size);
+            }
+            for (int k = 0; k < 64; k++)
+            {
+                sfree(blocks[k]);
+            }
+        });
+    }
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+    REQUIRE(corrupted == 0);
+    REQUIRE(_num_free_blocks() == _num_allocated_blocks());
+}
@@ -0,0 +1,74 @@
+#include "my_stdlib.h"
+#include "smalloc_ext.h"
+#include <catch2/catch_test_macros.hpp>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#define MAX_ELEMENT_SIZE (128 * 1024)
+
+// blocks of every superblock, in address order
+static std::vector<std::vector<uint8_t>> dump_heap(SmallocHeapHeader &header)
+{
+    FILE *file = tmpfile();
+    REQUIRE(file != nullptr);
+    REQUIRE(smalloc_dump_heap(fileno(file)) == 0);
+    rewind(file);
+
+    REQUIRE(fread(&header, sizeof(header), 1, file) == 1);
+    REQUIRE(memcmp(header.magic, SMALLOC_HEAP_MAGIC, sizeof(header.magic)) == 0);
+
+    std::vector<std::vector<uint8_t>> superblocks(header.superblocks);
+    for (auto &blocks : superblocks)
+    {
+        uint32_t num_blocks;
+        REQUIRE(fread(&num_blocks, sizeof(num_blocks), 1, file) == 1);
+        blocks.resize(num_blocks);
+        REQUIRE(fread(blocks.data(), 1, num_blocks, file) == num_blocks);
+    }
+    REQUIRE(fgetc(file) == EOF);
+    fclose(file);
+    return superblocks;
+}
+
+TEST_CASE("dump heap", "[malloc4]")
+{
+    void *a = smalloc(100);
+    REQUIRE(a != nullptr);
+    void *b = smalloc(MAX_ELEMENT_SIZE); // mmapped, not in the map
+    REQUIRE(b != nullptr);
+
+    SmallocHeapHeader header;
+    std::vector<std::vector<uint8_t>> superblocks = dump_heap(header);
+    REQUIRE(header.superblocks == 32);
+    REQUIRE(header.superblock_size == MAX_ELEMENT_SIZE);
+    REQUIRE(header.min_block_size == 128);
+
+    size_t used = 0;
+    for (auto &blocks : superblocks)
+    {
+        size_t size = 0;
+        for (uint8_t block : blocks)
+        {
+            size += (size_t)header.min_block_size << (block & ~SMALLOC_HEAP_USED);
+            if (block & SMALLOC_HEAP_USED)
+            {
+                REQUIRE((block & ~SMALLOC_HEAP_USED) == 1); // 100 bytes + metadata
+                ++used;
+            }
+        }
+        REQUIRE(size == header.superblock_size);
+    }
+    REQUIRE(used == 1);
+
+    sfree(a);
+    sfree(b);
+    superblocks = dump_heap(header);
+    for (auto &blocks : superblocks)
+    {
+        REQUIRE(blocks.size() == 1);
+        REQUIRE(blocks[0] == 10);
+    }
+}
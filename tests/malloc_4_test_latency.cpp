@@ -0,0 +1,79 @@
+#include "my_stdlib.h"
+#include "smalloc_ext.h"
+#include <catch2/catch_test_macros.hpp>
+
+#include <cstdio>
+#include <map>
+#include <sstream>
+#include <string>
+
+#define MMAP_THRESHOLD (128 * 1024)
+
+// path -> count, from the table smalloc_latency_dump writes
+static std::map<std::string, unsigned long> dump_counts()
+{
+    FILE *file = tmpfile();
+    REQUIRE(file != nullptr);
+    REQUIRE(smalloc_latency_dump(fileno(file)) == 0);
+
+    std::map<std::string, unsigned long> counts;
+    char line[256];
+    rewind(file);
+    REQUIRE(fgets(line, sizeof(line), file) != nullptr); // unit
+    REQUIRE(fgets(line, sizeof(line), file) != nullptr); // column names
+    while (fgets(line, sizeof(line), file) != nullptr)
+    {
+        std::istringstream row(line);
+        std::string path;
+        unsigned long count;
+        row >> path >> count;
+        counts[path] = count;
+    }
+    fclose(file);
+    return counts;
+}
+
+TEST_CASE("latency paths", "[malloc4]")
+{
+    smalloc_latency_reset();
+    std::map<std::string, unsigned long> counts = dump_counts();
+    REQUIRE(counts.size() == 9);
+    for (auto &count : counts)
+    {
+        REQUIRE(count.second == 0);
+    }
+
+    void *a = smalloc(100);
+    REQUIRE(a != nullptr);
+    void *b = smalloc(MMAP_THRESHOLD);
+    REQUIRE(b != nullptr);
+    REQUIRE(srealloc(a, 50) == a);
+    sfree(b);
+    sfree(a);
+    REQUIRE(smalloc(0) == nullptr); // failed calls take no path
+
+    counts = dump_counts();
+    REQUIRE(counts["hit"] + counts["split"] == 1);
+    REQUIRE(counts["mmap"] == 1);
+    REQUIRE(counts["hugetlb_mmap"] == 0);
+    REQUIRE(counts["realloc_in_place"] == 1);
+    REQUIRE(counts["realloc_move"] == 0);
+    REQUIRE(counts["munmap"] == 1);
+    REQUIRE(counts["free"] + counts["join"] == 1);
+}
+
+TEST_CASE("latency split and join", "[malloc4]")
+{
+    // a fresh heap only has max order blocks, so the first small block splits all the way down
+    void *a = smalloc(10);
+    REQUIRE(a != nullptr);
+    void *b = smalloc(10);
+    REQUIRE(b != nullptr);
+    sfree(b);
+    sfree(a);
+
+    std::map<std::string, unsigned long> counts = dump_counts();
+    REQUIRE(counts["split"] >= 1);
+    REQUIRE(counts["hit"] >= 1);
+    REQUIRE(counts["join"] >= 1);
+}
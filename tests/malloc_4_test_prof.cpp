@@ -0,0 +1,116 @@
+#include "my_stdlib.h"
+#include "smalloc_ext.h"
+#include <catch2/catch_test_macros.hpp>
+
+#include <cstdio>
+#include <string>
+#include <unistd.h>
+
+#define MMAP_THRESHOLD (128 * 1024)
+
+static std::string dump_profile()
+{
+    FILE *file = tmpfile();
+    REQUIRE(file != nullptr);
+    REQUIRE(smalloc_prof_dump(fileno(file)) == 0);
+
+    std::string profile;
+    char buffer[4096];
+    size_t read_bytes;
+    rewind(file);
+    while ((read_bytes = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    {
+        profile.append(buffer, read_bytes);
+    }
+    fclose(file);
+    return profile;
+}
+
+static std::string header(const std::string &profile)
+{
+    return profile.substr(0, profile.find('\n'));
+}
+
+TEST_CASE("heap profiler off", "[malloc4]")
+{
+    void *a = smalloc(100);
+    REQUIRE(a != nullptr);
+    REQUIRE(header(dump_profile()) == "heap profile: 0: 0 [0: 0] @ heap_v2/0");
+    sfree(a);
+}
+
+TEST_CASE("heap profiler samples", "[malloc4]")
+{
+    smalloc_prof_sample(1); // every allocation
+    void *a = smalloc(100);
+    void *b = smalloc(1000);
+    void *c = smalloc(MMAP_THRESHOLD + 100);
+    REQUIRE(a != nullptr);
+    REQUIRE(b != nullptr);
+    REQUIRE(c != nullptr);
+
+    std::string profile = dump_profile();
+    REQUIRE(header(profile) == "heap profile: 3: " + std::to_string(MMAP_THRESHOLD + 1200) + " [3: " +
+                                   std::to_string(MMAP_THRESHOLD + 1200) + "] @ heap_v2/1");
+    REQUIRE(profile.find("\n1: 100 [1: 100] @ 0x") != std::string::npos);
+    REQUIRE(profile.find("\nMAPPED_LIBRARIES:\n") != std::string::npos);
+
+    sfree(c);
+    REQUIRE(header(dump_profile()) == "heap profile: 2: 1100 [2: 1100] @ heap_v2/1");
+
+    // b's buddy below it is free, so growing b moves its metadata
+    sfree(a);
+    a = smalloc(100);
+    sfree(b);
+    b = smalloc(100);
+    REQUIRE(b != a);
+    sfree(a);
+    REQUIRE(srealloc(b, 300) == a);
+    b = a;
+    REQUIRE(header(dump_profile()) == "heap profile: 1: 100 [1: 100] @ heap_v2/1");
+
+    smalloc_prof_sample(0);
+    void *d = smalloc(100);
+    REQUIRE(header(dump_profile()) == "heap profile: 1: 100 [1: 100] @ heap_v2/0");
+
+    sfree(b);
+    sfree(d);
+    REQUIRE(header(dump_profile()) == "heap profile: 0: 0 [0: 0] @ heap_v2/0");
+}
+
+TEST_CASE("heap profiler churn", "[malloc4]")
+{
+    smalloc_prof_sample(1);
+    void *kept[100];
+    for (int i = 0; i < 100; i++)
+    {
+        kept[i] = smalloc(100);
+        REQUIRE(kept[i] != nullptr);
+    }
+
+    // each freed sample leaves a tombstone, 2000 blocks apart are more than the table takes before it is rebuilt
+    for (int round = 0; round < 10; round++)
+    {
+        void *blocks[2000];
+        for (int i = 0; i < 2000; i++)
+        {
+            blocks[i] = smalloc(100 + round);
+            REQUIRE(blocks[i] != nullptr);
+        }
+        REQUIRE(header(dump_profile()) == "heap profile: 2100: " + std::to_string(10000 + 2000 * (100 + round)) +
+                                              " [2100: " + std::to_string(10000 + 2000 * (100 + round)) +
+                                              "] @ heap_v2/1");
+        for (int i = 0; i < 2000; i++)
+        {
+            sfree(blocks[i]);
+        }
+    }
+    REQUIRE(header(dump_profile()) == "heap profile: 100: 10000 [100: 10000] @ heap_v2/1");
+
+    for (int i = 0; i < 100; i++)
+    {
+        sfree(kept[i]);
+    }
+    REQUIRE(header(dump_profile()) == "heap profile: 0: 0 [0: 0] @ heap_v2/1");
+    smalloc_prof_sample(0);
+}
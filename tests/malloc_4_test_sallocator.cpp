@@ -0,0 +1,129 @@
+#include "my_stdlib.h"
+#include "sallocator.h"
+#include <catch2/catch_test_macros.hpp>
+
+#include <cstdint>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+struct alignas(64) CacheLine
+{
+    char data[64];
+};
+
+TEST_CASE("saligned_alloc", "[malloc4]")
+{
+    for (size_t alignment = 1; alignment <= 4096; alignment <<= 1)
+    {
+        char *a = (char *)saligned_alloc(alignment, 100);
+        REQUIRE(a != nullptr);
+        REQUIRE((uintptr_t)a % alignment == 0);
+        REQUIRE(smalloc_usable_size(a) >= 100);
+        for (int i = 0; i < 100; i++)
+        {
+            a[i] = 'a';
+        }
+        sfree(a);
+    }
+    REQUIRE(_num_free_blocks() == _num_allocated_blocks());
+
+    REQUIRE(saligned_alloc(3, 100) == nullptr);
+    REQUIRE(saligned_alloc(0, 100) == nullptr);
+}
+
+TEST_CASE("saligned_alloc srealloc", "[malloc4]")
+{
+    int *a = (int *)saligned_alloc(256, 10 * sizeof(int));
+    REQUIRE(a != nullptr);
+    for (int i = 0; i < 10; i++)
+    {
+        a[i] = i;
+    }
+
+    REQUIRE(srealloc(a, 5 * sizeof(int)) == a);
+
+    int *b = (int *)srealloc(a, 1000 * sizeof(int));
+    REQUIRE(b != nullptr);
+    for (int i = 0; i < 10; i++)
+    {
+        REQUIRE(b[i] == i);
+    }
+    sfree(b);
+    REQUIRE(_num_free_blocks() == _num_allocated_blocks());
+}
+
+TEST_CASE("SAllocator vector", "[malloc4]")
+{
+    void *base = sbrk(0);
+    {
+        std::vector<int, SAllocator<int>> v;
+        for (int i = 0; i < 1000; i++)
+        {
+            v.push_back(i);
+        }
+        REQUIRE(_num_free_blocks() < _num_allocated_blocks());
+        REQUIRE((void *)v.data() >= base);
+        for (int i = 0; i < 1000; i++)
+        {
+            REQUIRE(v[i] == i);
+        }
+
+        std::vector<CacheLine, SAllocator<CacheLine>> lines(10);
+        REQUIRE((uintptr_t)lines.data() % 64 == 0);
+    }
+    REQUIRE(_num_free_blocks() == _num_allocated_blocks());
+}
+
+TEST_CASE("SAllocator unordered_map", "[malloc4]")
+{
+    {
+        std::unordered_map<int, int, std::hash<int>, std::equal_to<int>, SAllocator<std::pair<const int, int>>> m;
+        for (int i = 0; i < 500; i++)
+        {
+            m[i] = i * 2;
+        }
+        for (int i = 0; i < 500; i++)
+        {
+            REQUIRE(m[i] == i * 2);
+        }
+    }
+    REQUIRE(_num_free_blocks() == _num_allocated_blocks());
+}
+
+TEST_CASE("SAllocator expand", "[malloc4]")
+{
+    SAllocator<char> allocator;
+    char *a = allocator.allocate(10);
+    REQUIRE(a != nullptr);
+    REQUIRE(allocator.expand(a, 1000));
+    REQUIRE(smalloc_usable_size(a) >= 1000);
+
+    char *b = allocator.allocate(10);
+    REQUIRE_FALSE(allocator.expand(a, 128 * 1024));
+    allocator.deallocate(a, 1000);
+    allocator.deallocate(b, 10);
+    REQUIRE(_num_free_blocks() == _num_allocated_blocks());
+}
+
+TEST_CASE("SMemoryResource", "[malloc4]")
+{
+    {
+        std::pmr::vector<CacheLine> lines(smalloc_resource());
+        lines.resize(100);
+        REQUIRE((uintptr_t)lines.data() % 64 == 0);
+        REQUIRE(_num_free_blocks() < _num_allocated_blocks());
+
+        std::pmr::unordered_map<int, int> m(smalloc_resource());
+        for (int i = 0; i < 500; i++)
+        {
+            m[i] = i;
+        }
+        REQUIRE(m.size() == 500);
+
+        SMemoryResource other;
+        REQUIRE(other.is_equal(*smalloc_resource()));
+        REQUIRE_FALSE(smalloc_resource()->is_equal(*std::pmr::new_delete_resource()));
+    }
+    REQUIRE(_num_free_blocks() == _num_allocated_blocks());
+}
@@ -0,0 +1,173 @@
+#include "my_stdlib.h"
+#include "smalloc_ext.h"
+#include <catch2/catch_test_macros.hpp>
+
+#include <cstdint>
+#include <cstring>
+
+#define MMAP_THRESHOLD (128 * 1024)
+
+static bool is_zero(const char *p, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        if (p[i] != 0)
+            return false;
+    }
+    return true;
+}
+
+TEST_CASE("smallocx zero", "[malloc4]")
+{
+    char *a = (char *)smalloc(100);
+    REQUIRE(a != nullptr);
+    std::memset(a, 'a', 100);
+    sfree(a);
+
+    char *b = (char *)smallocx(100, SMALLOCX_ZERO);
+    REQUIRE(b == a);
+    REQUIRE(is_zero(b, smalloc_usable_size(b)));
+
+    char *c = (char *)smallocx(MMAP_THRESHOLD * 2, SMALLOCX_ZERO);
+    REQUIRE(c != nullptr);
+    REQUIRE(is_zero(c, MMAP_THRESHOLD * 2));
+
+    sfree(b);
+    sfree(c);
+    REQUIRE(_num_free_blocks() == _num_allocated_blocks());
+}
+
+TEST_CASE("smallocx align", "[malloc4]")
+{
+    for (size_t lg = 0; lg <= 12; lg++)
+    {
+        char *a = (char *)smallocx(100, SMALLOCX_LG_ALIGN(lg) | SMALLOCX_ZERO);
+        REQUIRE(a != nullptr);
+        REQUIRE((uintptr_t)a % ((size_t)1 << lg) == 0);
+        REQUIRE(is_zero(a, 100));
+        sfree(a);
+    }
+
+    char *b = (char *)smallocx(MMAP_THRESHOLD * 2, SMALLOCX_ALIGN(4096));
+    REQUIRE(b != nullptr);
+    REQUIRE((uintptr_t)b % 4096 == 0);
+    sfree(b);
+    REQUIRE(_num_free_blocks() == _num_allocated_blocks());
+}
+
+TEST_CASE("smallocx populate", "[malloc4]")
+{
+    char *a = (char *)smallocx(10000, SMALLOCX_POPULATE);
+    REQUIRE(a != nullptr);
+    std::memset(a, 'a', 10000);
+
+    char *b = (char *)smallocx(MMAP_THRESHOLD * 4, SMALLOCX_POPULATE | SMALLOCX_ZERO);
+    REQUIRE(b != nullptr);
+    REQUIRE(is_zero(b, MMAP_THRESHOLD * 4));
+
+    sfree(a);
+    sfree(b);
+    REQUIRE(_num_free_blocks() == _num_allocated_blocks());
+}
+
+TEST_CASE("smallocx hugepage flags", "[malloc4]")
+{
+    // above the 4MB hugepage threshold, but forced onto regular pages
+    char *a = (char *)smallocx(5 * 1024 * 1024, SMALLOCX_NO_HUGEPAGE);
+    REQUIRE(a != nullptr);
+    std::memset(a, 'a', 5 * 1024 * 1024);
+    sfree(a);
+
+    // a whole hugepage when the system has them reserved, else a heap block
+    char *b = (char *)smallocx(100, SMALLOCX_HUGEPAGE);
+    if (b != nullptr)
+    {
+        REQUIRE(smalloc_usable_size(b) >= 100);
+        std::memset(b, 'b', 100);
+        sfree(b);
+    }
+    REQUIRE(_num_free_blocks() == _num_allocated_blocks());
+}
+
+TEST_CASE("smallocx hugepage fallback", "[malloc4]")
+{
+    // without hugetlb a small SMALLOCX_HUGEPAGE request stays in the heap, and is freed back to it as such
+    char *a = (char *)smallocx(100, SMALLOCX_HUGEPAGE);
+#ifdef SMALLOC_NO_HUGETLB
+    SmallocStats stats;
+    REQUIRE(a != nullptr);
+    REQUIRE(smalloc_stats(&stats) == 0);
+    REQUIRE(stats.mmap_blocks == 0);
+    REQUIRE(stats.hugetlb_blocks == 0);
+#endif
+    sfree(a);
+
+    char *b = (char *)smalloc(150);
+    char *c = (char *)smalloc(150);
+    REQUIRE(b != nullptr);
+    REQUIRE(c != nullptr);
+    REQUIRE(smalloc_usable_size(b) >= 150);
+    std::memset(c, 'c', 150);
+    std::memset(b, 'b', 150);
+    REQUIRE(c[0] == 'c');
+    REQUIRE(c[149] == 'c');
+    sfree(b);
+    sfree(c);
+    REQUIRE(_num_free_blocks() == _num_allocated_blocks());
+}
+
+TEST_CASE("sreallocx", "[malloc4]")
+{
+    char *a = (char *)smalloc(100);
+    char *b = (char *)smalloc(100);
+    REQUIRE(a != nullptr);
+    REQUIRE(b != nullptr);
+    std::memset(a, 'a', 100);
+
+    REQUIRE(sreallocx(a, 300, SMALLOCX_NO_MOVE) == nullptr);
+    REQUIRE(a[99] == 'a');
+
+    size_t old_size = smalloc_usable_size(a);
+    char *c = (char *)sreallocx(a, 1000, SMALLOCX_ZERO | SMALLOCX_ALIGN(512));
+    REQUIRE(c != nullptr);
+    REQUIRE((uintptr_t)c % 512 == 0);
+    for (int i = 0; i < 100; i++)
+    {
+        REQUIRE(c[i] == 'a');
+    }
+    REQUIRE(is_zero(c + old_size, 1000 - old_size));
+
+    sfree(b);
+    sfree(c);
+    REQUIRE(_num_free_blocks() == _num_allocated_blocks());
+}
+
+TEST_CASE("sreallocx align failure", "[malloc4]")
+{
+    char *a = (char *)smalloc(100);
+    REQUIRE(a != nullptr);
+    std::memset(a, 'a', 100);
+
+    // a misaligned block can't be fixed in place
+    int align = SMALLOCX_ALIGN(4096);
+    if ((uintptr_t)a % 4096 != 0)
+    {
+        REQUIRE(sreallocx(a, 100, SMALLOCX_NO_MOVE | align) == nullptr);
+    }
+
+    // no room for the aligned copy, the old block has to survive untouched
+    REQUIRE(sreallocx(a, 100000000, align) == nullptr);
+    REQUIRE(smalloc_usable_size(a) >= 100);
+    for (int i = 0; i < 100; i++)
+    {
+        REQUIRE(a[i] == 'a');
+    }
+
+    char *b = (char *)sreallocx(a, 200, align);
+    REQUIRE(b != nullptr);
+    REQUIRE((uintptr_t)b % 4096 == 0);
+    REQUIRE(b[0] == 'a');
+    REQUIRE(b[99] == 'a');
+    sfree(b);
+    REQUIRE(_num_free_blocks() == _num_allocated_blocks());
+}
@@ -0,0 +1,200 @@
+#include "my_stdlib.h"
+#include "smalloc_ext.h"
+#include <catch2/catch_test_macros.hpp>
+
+#include <cstring>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+#define MMAP_THRESHOLD (128 * 1024)
+
+static size_t total(const size_t *blocks)
+{
+    size_t sum = 0;
+    for (int i = 0; i < SMALLOC_STATS_ORDERS; i++)
+    {
+        sum += blocks[i];
+    }
+    return sum;
+}
+
+TEST_CASE("smalloc_stats orders", "[malloc4]")
+{
+    SmallocStats stats;
+    REQUIRE(smalloc_stats(nullptr) == -1);
+
+    void *a = smalloc(40);
+    REQUIRE(a != nullptr);
+    REQUIRE(smalloc_stats(&stats) == 0);
+
+    REQUIRE(stats.used_blocks[0] == 1);
+    REQUIRE(stats.free_blocks[0] == 1);
+    for (int i = 1; i < 10; i++)
+    {
+        REQUIRE(stats.free_blocks[i] == 1);
+        REQUIRE(stats.used_blocks[i] == 0);
+    }
+    REQUIRE(stats.free_blocks[10] == 31);
+    REQUIRE(total(stats.free_blocks) == _num_free_blocks());
+    REQUIRE(total(stats.free_blocks) + total(stats.used_blocks) == _num_allocated_blocks());
+
+    REQUIRE(stats.splits == 10);
+    REQUIRE(stats.joins == 0);
+    REQUIRE(stats.sbrk_calls >= 1);
+    REQUIRE(stats.requested_bytes == 40);
+    REQUIRE(stats.block_bytes == 128);
+
+    sfree(a);
+    REQUIRE(smalloc_stats(&stats) == 0);
+    REQUIRE(stats.joins == 10);
+    REQUIRE(stats.free_blocks[10] == 32);
+    REQUIRE(total(stats.used_blocks) == 0);
+    REQUIRE(stats.requested_bytes == 0);
+    REQUIRE(stats.block_bytes == 0);
+}
+
+TEST_CASE("smalloc_stats mmap", "[malloc4]")
+{
+    SmallocStats stats;
+
+    void *a = smalloc(MMAP_THRESHOLD + 100);
+    REQUIRE(a != nullptr);
+    REQUIRE(smalloc_stats(&stats) == 0);
+    REQUIRE(stats.mmap_blocks == 1);
+    REQUIRE(stats.mmap_bytes == MMAP_THRESHOLD + 100 + _size_meta_data());
+    REQUIRE(stats.hugetlb_blocks == 0);
+    REQUIRE(stats.mmap_calls == 1);
+    REQUIRE(stats.requested_bytes == MMAP_THRESHOLD + 100);
+
+    void *b = srealloc(a, MMAP_THRESHOLD + 200);
+    REQUIRE(b != nullptr);
+    REQUIRE(smalloc_stats(&stats) == 0);
+    REQUIRE(stats.mmap_blocks == 1);
+    REQUIRE(stats.mmap_calls == 2);
+    REQUIRE(stats.munmap_calls == 1);
+    REQUIRE(stats.requested_bytes == MMAP_THRESHOLD + 200);
+
+    sfree(b);
+    REQUIRE(smalloc_stats(&stats) == 0);
+    REQUIRE(stats.mmap_blocks == 0);
+    REQUIRE(stats.mmap_bytes == 0);
+    REQUIRE(stats.munmap_calls == 2);
+    REQUIRE(stats.requested_bytes == 0);
+}
+
+TEST_CASE("smalloc_stats fragmentation", "[malloc4]")
+{
+    SmallocStats stats;
+
+    void *a = smalloc(100);
+    void *b = smalloc(1000);
+    REQUIRE(a != nullptr);
+    REQUIRE(b != nullptr);
+    REQUIRE(smalloc_stats(&stats) == 0);
+    REQUIRE(stats.requested_bytes == 1100);
+    REQUIRE(stats.block_bytes == 256 + 2048);
+
+    a = srealloc(a, 200);
+    REQUIRE(a != nullptr);
+    REQUIRE(smalloc_stats(&stats) == 0);
+    REQUIRE(stats.requested_bytes == 1200);
+    REQUIRE(stats.block_bytes == 256 + 2048);
+
+    a = srealloc(a, 300);
+    REQUIRE(a != nullptr);
+    REQUIRE(smalloc_stats(&stats) == 0);
+    REQUIRE(stats.requested_bytes == 1300);
+    REQUIRE(stats.block_bytes == 512 + 2048);
+
+    sfree(a);
+    sfree(b);
+    REQUIRE(smalloc_stats(&stats) == 0);
+    REQUIRE(stats.requested_bytes == 0);
+    REQUIRE(stats.block_bytes == 0);
+}
+
+#define PURGE_KEEP 4 // SMALLOC_PURGE_KEEP
+
+TEST_CASE("smalloc_stats purge", "[malloc4]")
+{
+    SmallocStats stats;
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t size = MMAP_THRESHOLD - _size_meta_data(); // a whole top order block
+
+    char *blocks[PURGE_KEEP + 1];
+    for (int i = 0; i < PURGE_KEEP + 1; i++)
+    {
+        blocks[i] = (char *)smalloc(size);
+        REQUIRE(blocks[i] != nullptr);
+        std::memset(blocks[i], 'a', size);
+    }
+    REQUIRE(smalloc_stats(&stats) == 0);
+    REQUIRE(stats.purged_bytes == 0);
+    size_t madvise_calls = stats.madvise_calls;
+
+    // the lowest PURGE_KEEP stay resident
+    for (int i = 0; i < PURGE_KEEP; i++)
+    {
+        sfree(blocks[i]);
+    }
+    REQUIRE(smalloc_stats(&stats) == 0);
+    REQUIRE(stats.madvise_calls == madvise_calls);
+    REQUIRE(stats.purged_bytes == 0);
+
+    char *a = blocks[PURGE_KEEP];
+    sfree(a);
+    REQUIRE(smalloc_stats(&stats) == 0);
+    REQUIRE(stats.madvise_calls == madvise_calls + 1);
+    REQUIRE(stats.purged_bytes == MMAP_THRESHOLD - page_size);
+
+    // only the header's page stays resident
+    std::vector<unsigned char> resident(MMAP_THRESHOLD / page_size);
+    REQUIRE(mincore(a - _size_meta_data(), MMAP_THRESHOLD, resident.data()) == 0);
+    REQUIRE((resident[0] & 1) == 1);
+    size_t resident_pages = 0;
+    for (size_t i = 1; i < resident.size(); i++)
+    {
+        resident_pages += resident[i] & 1;
+    }
+    REQUIRE(resident_pages == 0);
+
+    // and comes back zeroed once the resident ones below it are taken
+    for (int i = 0; i < PURGE_KEEP; i++)
+    {
+        REQUIRE(smalloc(size) == blocks[i]);
+    }
+    char *b = (char *)scalloc(1, size);
+    REQUIRE(b == a);
+    size_t nonzero = 0;
+    for (size_t i = 0; i < size; i++)
+    {
+        nonzero += b[i] != 0;
+    }
+    REQUIRE(nonzero == 0);
+    REQUIRE(smalloc_stats(&stats) == 0);
+    REQUIRE(stats.purged_bytes == 0);
+    sfree(b);
+    for (int i = 0; i < PURGE_KEEP; i++)
+    {
+        sfree(blocks[i]);
+    }
+}
+
+TEST_CASE("smalloc_stats no purge on churn", "[malloc4]")
+{
+    SmallocStats stats;
+    REQUIRE(smalloc_stats(&stats) == 0);
+    size_t madvise_calls = stats.madvise_calls;
+
+    // each sfree rebuilds the top order block the smalloc split
+    for (int i = 0; i < 1000; i++)
+    {
+        void *a = smalloc(100);
+        REQUIRE(a != nullptr);
+        sfree(a);
+    }
+    REQUIRE(smalloc_stats(&stats) == 0);
+    REQUIRE(stats.madvise_calls == madvise_calls);
+    REQUIRE(stats.purged_bytes == 0);
+}